@@ -0,0 +1,636 @@
+// Times each pipeline stage in isolation: decode+scale, render, escape
+// encoding, export raster+encode and the audio callback. Stages run on
+// synthetic frames, or on frames decoded from --input, and report frames/s,
+// MB/s and (for the cell stages) ns/cell. --json writes the same numbers in
+// a stable layout meant for diffing between builds.
+
+#include "ansi_encoder.hpp"
+#include "ascii_renderer.hpp"
+#include "audio_player.hpp"
+#include "decoder.hpp"
+#include "exporter.hpp"
+#include "simd_kernels.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <libavutil/log.h>
+}
+
+using namespace asciiplay;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Distinct source frames the render and encode stages cycle through.
+constexpr int kSourceFrames = 8;
+constexpr int kWarmupFrames = 3;
+// Sample pixels per cell, as the player's default --decode-scale gives;
+// rows get twice as many so half-block variants see the same source.
+constexpr int kSamplesX = 2;
+constexpr int kSamplesY = 4;
+constexpr double kAudioSeconds = 1.0;
+constexpr int kAudioChunkFrames = 480; // 10 ms at 48 kHz
+
+struct Options {
+    std::string input;
+    int frames = 120;
+    int cols = 120;
+    int rows = 60;
+    int renderThreads = 1;
+    std::string exportPreset = "medium";
+    std::string json;   // "-" for stdout
+    std::string stages; // comma-separated filter; empty runs everything
+};
+
+struct Result {
+    std::string stage;
+    std::string variant;
+    uint64_t frames = 0;
+    uint64_t cells = 0; // per frame; 0 when ns/cell means nothing
+    uint64_t bytes = 0; // produced (or consumed, for audio) in total
+    double seconds = 0.0;
+    std::vector<std::pair<std::string, double>> extra;
+    std::string skipped; // reason, when the stage could not run
+
+    double fps() const { return seconds > 0 ? frames / seconds : 0.0; }
+    double mbPerSec() const { return seconds > 0 ? bytes / seconds / 1e6 : 0.0; }
+    double nsPerCell() const { return frames && cells ? seconds * 1e9 / (static_cast<double>(frames) * cells) : 0.0; }
+};
+
+struct Report {
+    std::string simdKernel;
+    bool simdChecked = false;
+    bool simdBitExact = true;
+    std::vector<Result> results;
+};
+
+double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+bool wantStage(const Options& opts, const std::string& stage)
+{
+    if (opts.stages.empty()) return true;
+    std::stringstream list(opts.stages);
+    std::string item;
+    while (std::getline(list, item, ',')) {
+        if (item == stage) return true;
+    }
+    return false;
+}
+
+const char* modeName(RenderMode mode)
+{
+    switch (mode) {
+    case RenderMode::Gray: return "gray";
+    case RenderMode::ANSI256: return "256";
+    case RenderMode::TrueColor: return "truecolor";
+    }
+    return "?";
+}
+
+const char* ditherName(DitherMode dither)
+{
+    switch (dither) {
+    case DitherMode::Off: return "off";
+    case DitherMode::Bayer2: return "bayer2";
+    case DitherMode::Bayer4: return "bayer4";
+    case DitherMode::BlueNoise: return "bluenoise";
+    case DitherMode::FloydSteinberg: return "fs";
+    case DitherMode::Serpentine: return "serpentine";
+    }
+    return "?";
+}
+
+// A drifting colour gradient with some noise, so neither the colour tables
+// nor the delta encoder see a degenerate picture.
+VideoFrame syntheticFrame(int width, int height, int index, std::mt19937& rng)
+{
+    VideoFrame frame;
+    frame.width = width;
+    frame.height = height;
+    frame.format = AV_PIX_FMT_RGB24;
+    frame.data.resize(static_cast<size_t>(width) * height * 3);
+    std::uniform_int_distribution<int> noise(-12, 12);
+    uint8_t* out = frame.data.data();
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int r = (x * 255 / std::max(1, width - 1) + index * 9) & 0xFF;
+            int g = (y * 255 / std::max(1, height - 1) + index * 5) & 0xFF;
+            int b = ((x + y) * 4 + index * 13) & 0xFF;
+            *out++ = static_cast<uint8_t>(std::clamp(r + noise(rng), 0, 255));
+            *out++ = static_cast<uint8_t>(std::clamp(g + noise(rng), 0, 255));
+            *out++ = static_cast<uint8_t>(std::clamp(b + noise(rng), 0, 255));
+        }
+    }
+    frame.pts = index / 30.0;
+    return frame;
+}
+
+// A still picture with one small box moving over it, the way a screencast or
+// a slide with a cursor looks, for the incremental render path.
+VideoFrame screencastFrame(const VideoFrame& base, int index)
+{
+    VideoFrame frame;
+    frame.width = base.width;
+    frame.height = base.height;
+    frame.format = base.format;
+    frame.pts = index / 30.0;
+    frame.data.resize(base.data.size());
+    std::copy(base.data.begin(), base.data.end(), frame.data.begin());
+    int boxWidth = std::max(1, base.width / 8);
+    int boxHeight = std::max(1, base.height / 8);
+    int left = (index * boxWidth / 2) % std::max(1, base.width - boxWidth);
+    int top = (index * boxHeight / 3) % std::max(1, base.height - boxHeight);
+    for (int y = top; y < top + boxHeight; ++y) {
+        uint8_t* line = frame.data.data() + (static_cast<size_t>(y) * base.width + left) * 3;
+        std::fill(line, line + boxWidth * 3, static_cast<uint8_t>(index * 37));
+    }
+    return frame;
+}
+
+// Gray mode is fed a luma plane by the decoder; BT.601 weights are close
+// enough for timing purposes.
+VideoFrame lumaFrame(const VideoFrame& rgb)
+{
+    VideoFrame frame;
+    frame.width = rgb.width;
+    frame.height = rgb.height;
+    frame.format = AV_PIX_FMT_GRAY8;
+    frame.pts = rgb.pts;
+    frame.data.resize(static_cast<size_t>(rgb.width) * rgb.height);
+    const uint8_t* src = rgb.data.data();
+    for (uint8_t& y : frame.data) {
+        y = static_cast<uint8_t>((src[0] * 77 + src[1] * 150 + src[2] * 29) >> 8);
+        src += 3;
+    }
+    return frame;
+}
+
+// The vector kernels must reproduce the scalar reference bit for bit, over
+// odd widths, unaligned rows and the tallest block that cannot overflow.
+bool checkSimd(Report& report)
+{
+    const SimdKernels& simd = simd_kernels();
+    const SimdKernels& scalar = scalar_kernels();
+    report.simdKernel = simd.name;
+    report.simdChecked = true;
+    std::mt19937 rng(1234);
+    std::vector<uint8_t> source;
+    std::vector<uint16_t> expected;
+    std::vector<uint16_t> actual;
+    for (int trial = 0; trial < 2000; ++trial) {
+        int bytes = 1 + static_cast<int>(rng() % 700);
+        int rows = trial % 8 == 0 ? kMaxColumnRows : 1 + static_cast<int>(rng() % kMaxColumnRows);
+        size_t stride = bytes + rng() % 64;
+        size_t offset = rng() % 16;
+        bool saturate = trial % 4 == 0;
+        source.resize(offset + stride * rows);
+        for (uint8_t& v : source) v = saturate ? static_cast<uint8_t>(255 - rng() % 4) : static_cast<uint8_t>(rng());
+        expected.assign(bytes, 0xAAAA);
+        actual.assign(bytes, 0x5555);
+        scalar.columnSums(source.data() + offset, stride, rows, bytes, expected.data());
+        simd.columnSums(source.data() + offset, stride, rows, bytes, actual.data());
+        if (expected != actual) {
+            std::cerr << "SIMD mismatch in " << simd.name << ": bytes=" << bytes << " rows=" << rows
+                      << " stride=" << stride << " offset=" << offset << std::endl;
+            report.simdBitExact = false;
+            return false;
+        }
+    }
+    return true;
+}
+
+Result benchDecode(const Options& opts, std::vector<VideoFrame>& keep)
+{
+    Result result;
+    result.stage = "decode";
+    result.variant = "rgb24-scaled";
+    if (opts.input.empty()) {
+        result.skipped = "no --input";
+        return result;
+    }
+    DecoderOptions decOpt;
+    decOpt.url = opts.input;
+    decOpt.enableAudio = false;
+    Decoder decoder;
+    std::string err;
+    if (!decoder.open(decOpt, err)) {
+        result.skipped = err;
+        return result;
+    }
+    decoder.setOutputSize(opts.cols * kSamplesX, opts.rows * kSamplesY);
+    auto start = Clock::now();
+    decoder.start();
+    VideoFrame frame;
+    while (result.frames < static_cast<uint64_t>(opts.frames) && decoder.popVideoFrame(frame)) {
+        ++result.frames;
+        result.bytes += frame.data.size();
+        if (keep.size() < static_cast<size_t>(kSourceFrames)) {
+            // Leased buffers go back to the decoder; keep a private copy.
+            VideoFrame copy = frame;
+            copy.data = FrameBuffer<uint8_t>();
+            copy.data.resize(frame.data.size());
+            std::copy(frame.data.begin(), frame.data.end(), copy.data.begin());
+            keep.push_back(std::move(copy));
+        }
+    }
+    result.seconds = secondsSince(start);
+    decoder.stop();
+    if (result.frames == 0) result.skipped = "no video frames decoded";
+    return result;
+}
+
+Result benchRender(const Options& opts, const std::vector<VideoFrame>& sources, RenderMode mode,
+                   DitherMode dither, bool halfBlock, std::vector<AsciiFrame>* keep,
+                   const RenderOutputs& outputs = RenderOutputs{}, bool incremental = false)
+{
+    Result result;
+    result.stage = "render";
+    result.variant = std::string(modeName(mode)) + "/" + ditherName(dither) + (halfBlock ? "/halfblock" : "")
+        + (outputs.terminalString ? "" : "/cells") + (incremental ? "/incremental" : "");
+    result.cells = static_cast<uint64_t>(opts.cols) * opts.rows;
+
+    RendererConfig cfg;
+    cfg.mode = mode;
+    cfg.dither = dither;
+    cfg.halfBlock = halfBlock;
+    cfg.gridCols = opts.cols;
+    cfg.gridRows = opts.rows;
+    cfg.renderThreads = opts.renderThreads;
+    cfg.incremental = incremental;
+    AsciiRenderer renderer;
+    renderer.configure(cfg);
+
+    for (int i = 0; i < kWarmupFrames; ++i) renderer.render(sources[i % sources.size()], outputs);
+    auto start = Clock::now();
+    for (int i = 0; i < opts.frames; ++i) {
+        AsciiFrame frame = renderer.render(sources[i % sources.size()], outputs);
+        result.bytes += frame.terminalString.size();
+        if (keep && keep->size() < sources.size()) keep->push_back(std::move(frame));
+    }
+    result.seconds = secondsSince(start);
+    result.frames = static_cast<uint64_t>(opts.frames);
+    return result;
+}
+
+Result benchEncode(const Options& opts, const std::vector<AsciiFrame>& frames, RenderMode mode, bool delta)
+{
+    Result result;
+    result.stage = "encode";
+    result.variant = std::string(delta ? "delta/" : "full/") + modeName(mode);
+    result.cells = static_cast<uint64_t>(opts.cols) * opts.rows;
+
+    EncodeOptions options;
+    options.mode = mode;
+    options.halfBlock = frames.front().halfBlock;
+    EncodeBuffer buffer;
+    auto start = Clock::now();
+    for (int i = 0; i < opts.frames; ++i) {
+        const AsciiFrame& frame = frames[i % frames.size()];
+        const AsciiFrame& previous = frames[(i + frames.size() - 1) % frames.size()];
+        buffer.clear();
+        if (delta) {
+            encode_delta(frame, previous, options, frame.cells.size(), buffer);
+        } else {
+            char* out = buffer.reserveTail(max_encoded_rows(frame.cols, frame.rows));
+            buffer.commit(encode_rows(frame, options, 0, frame.rows, out));
+        }
+        result.bytes += buffer.size();
+    }
+    result.seconds = secondsSince(start);
+    result.frames = static_cast<uint64_t>(opts.frames);
+    return result;
+}
+
+Result benchExport(const Options& opts, const std::vector<AsciiFrame>& frames)
+{
+    Result result;
+    result.stage = "export";
+    result.variant = "raster+encode/" + opts.exportPreset;
+    result.cells = static_cast<uint64_t>(opts.cols) * opts.rows;
+
+    ExportConfig cfg;
+    cfg.outputFile = (std::filesystem::temp_directory_path() / "asciiplay_bench.mp4").string();
+    cfg.gridCols = opts.cols;
+    cfg.gridRows = opts.rows;
+    cfg.preset = opts.exportPreset;
+    std::string err;
+    auto start = Clock::now();
+    {
+        Exporter exporter;
+        if (!exporter.open(cfg, err)) {
+            result.skipped = err;
+            return result;
+        }
+        for (int i = 0; i < opts.frames; ++i) {
+            AsciiFrame frame = frames[i % frames.size()];
+            frame.pts = static_cast<double>(i) / cfg.fps;
+            if (!exporter.writeFrame(frame, err)) {
+                result.skipped = err;
+                break;
+            }
+            ++result.frames;
+        }
+        // Flushing the encoder is part of the cost.
+        exporter.close();
+    }
+    result.seconds = secondsSince(start);
+    uint64_t pixels = static_cast<uint64_t>(opts.cols) * cfg.fontW * opts.rows * cfg.fontH;
+    result.bytes = result.frames * pixels * 3 / 2; // YUV420P rastered
+    std::error_code ignored;
+    std::filesystem::remove(cfg.outputFile, ignored);
+    return result;
+}
+
+// Drives the real callback on miniaudio's null backend while a producer
+// keeps the ring topped up, then reports the time spent inside it.
+Result benchAudio()
+{
+    Result result;
+    result.stage = "audio";
+    result.variant = "callback/48k-stereo";
+
+    AudioConfig cfg;
+    cfg.nullDevice = true;
+    AudioPlayer player;
+    std::string err;
+    if (!player.start(48000, 2, cfg, err)) {
+        result.skipped = err;
+        return result;
+    }
+    std::atomic<bool> feeding{true};
+    std::thread producer([&] {
+        AudioFrame chunk;
+        chunk.samples.resize(static_cast<size_t>(kAudioChunkFrames) * 2);
+        for (size_t i = 0; i < chunk.samples.size(); ++i) {
+            chunk.samples.data()[i] = static_cast<int16_t>(8000 * std::sin(i * 0.05));
+        }
+        while (feeding.load()) player.enqueue(chunk);
+    });
+    std::this_thread::sleep_for(std::chrono::duration<double>(kAudioSeconds));
+    // The callback keeps draining the ring, so the producer gets out of a
+    // blocked enqueue() within one chunk.
+    feeding.store(false);
+    producer.join();
+    player.stop();
+
+    AudioCallbackStats stats = player.callbackStats();
+    result.frames = stats.frames;
+    result.seconds = stats.totalNanos / 1e9;
+    result.bytes = stats.frames * 2 * sizeof(float);
+    result.extra = {
+        {"callbacks", static_cast<double>(stats.calls)},
+        {"meanCallbackNs", stats.calls ? static_cast<double>(stats.totalNanos) / stats.calls : 0.0},
+        {"maxCallbackNs", static_cast<double>(stats.maxNanos)},
+    };
+    if (stats.calls == 0) result.skipped = "callback never ran";
+    return result;
+}
+
+std::string jsonString(const std::string& text)
+{
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out += ' ';
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+void writeJson(std::ostream& out, const Options& opts, const Report& report)
+{
+    out << std::setprecision(6) << "{\n"
+        << "  \"version\": 1,\n"
+        << "  \"grid\": [" << opts.cols << ", " << opts.rows << "],\n"
+        << "  \"frames\": " << opts.frames << ",\n"
+        << "  \"renderThreads\": " << opts.renderThreads << ",\n"
+        << "  \"input\": " << jsonString(opts.input) << ",\n"
+        << "  \"simd\": {\"kernel\": " << jsonString(report.simdKernel)
+        << ", \"checked\": " << (report.simdChecked ? "true" : "false")
+        << ", \"bitExact\": " << (report.simdBitExact ? "true" : "false") << "},\n"
+        << "  \"results\": [";
+    for (size_t i = 0; i < report.results.size(); ++i) {
+        const Result& r = report.results[i];
+        out << (i ? "," : "") << "\n    {\"stage\": " << jsonString(r.stage) << ", \"variant\": " << jsonString(r.variant);
+        if (!r.skipped.empty()) {
+            out << ", \"skipped\": " << jsonString(r.skipped) << "}";
+            continue;
+        }
+        out << ", \"frames\": " << r.frames << ", \"seconds\": " << r.seconds
+            << ", \"fps\": " << r.fps() << ", \"mbPerSec\": " << r.mbPerSec();
+        if (r.cells) out << ", \"nsPerCell\": " << r.nsPerCell();
+        for (const auto& [key, value] : r.extra) out << ", " << jsonString(key) << ": " << value;
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+void printTable(const Report& report)
+{
+    std::cout << "SIMD kernel: " << report.simdKernel;
+    if (report.simdChecked) std::cout << (report.simdBitExact ? " (bit-exact)" : " (MISMATCH)");
+    std::cout << "\n"
+              << std::left << std::setw(8) << "stage" << std::setw(28) << "variant" << std::right
+              << std::setw(12) << "frames/s" << std::setw(12) << "MB/s" << std::setw(12) << "ns/cell" << "\n";
+    std::cout << std::fixed << std::setprecision(1);
+    for (const Result& r : report.results) {
+        std::cout << std::left << std::setw(8) << r.stage << std::setw(28) << r.variant << std::right;
+        if (!r.skipped.empty()) {
+            std::cout << "  skipped: " << r.skipped << "\n";
+            continue;
+        }
+        std::cout << std::setw(12) << r.fps() << std::setw(12) << r.mbPerSec() << std::setw(12);
+        if (r.cells) std::cout << r.nsPerCell();
+        else std::cout << "-";
+        for (const auto& [key, value] : r.extra) std::cout << "  " << key << "=" << value;
+        std::cout << "\n";
+    }
+}
+
+void printHelp()
+{
+    std::cout << "asciiplay_bench [options]\n"
+              << "  --input <file>      decode this file and render its frames instead of synthetic ones\n"
+              << "  --frames <n>        frames per stage (default 120)\n"
+              << "  --grid <cols>x<rows>\n"
+              << "  --render-threads <n, 0 = auto>\n"
+              << "  --export-preset <ultrafast..veryslow>\n"
+              << "  --stage <list>      comma-separated: simd,decode,render,encode,export,audio\n"
+              << "  --json <file|->     write results as JSON\n"
+              << "  --help\n";
+}
+
+std::optional<Options> parseArgs(int argc, char** argv)
+{
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto nextValue = [&](std::string& out) -> bool {
+            if (i + 1 >= argc) return false;
+            out = argv[++i];
+            return true;
+        };
+        std::string value;
+        try {
+            if (arg == "--input") {
+                if (!nextValue(opts.input)) return std::nullopt;
+            } else if (arg == "--frames") {
+                if (!nextValue(value)) return std::nullopt;
+                opts.frames = std::stoi(value);
+                if (opts.frames <= 0) return std::nullopt;
+            } else if (arg == "--grid") {
+                if (!nextValue(value)) return std::nullopt;
+                auto pos = value.find('x');
+                if (pos == std::string::npos) return std::nullopt;
+                opts.cols = std::stoi(value.substr(0, pos));
+                opts.rows = std::stoi(value.substr(pos + 1));
+                if (opts.cols <= 0 || opts.rows <= 0) return std::nullopt;
+            } else if (arg == "--render-threads") {
+                if (!nextValue(value)) return std::nullopt;
+                opts.renderThreads = std::stoi(value);
+                if (opts.renderThreads < 0) return std::nullopt;
+            } else if (arg == "--export-preset") {
+                if (!nextValue(opts.exportPreset)) return std::nullopt;
+            } else if (arg == "--stage") {
+                if (!nextValue(opts.stages)) return std::nullopt;
+            } else if (arg == "--json") {
+                if (!nextValue(opts.json)) return std::nullopt;
+            } else {
+                printHelp();
+                return std::nullopt;
+            }
+        } catch (...) {
+            return std::nullopt;
+        }
+    }
+    return opts;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    av_log_set_level(AV_LOG_ERROR);
+    auto opts = parseArgs(argc, argv);
+    if (!opts) {
+        return 1;
+    }
+
+    Report report;
+    report.simdKernel = simd_kernels().name;
+    if (wantStage(*opts, "simd")) {
+        checkSimd(report);
+    }
+
+    // Real frames are decoded whether or not the decode stage is reported.
+    std::vector<VideoFrame> rgbSources;
+    if (wantStage(*opts, "decode") || !opts->input.empty()) {
+        Result decode = benchDecode(*opts, rgbSources);
+        if (wantStage(*opts, "decode")) report.results.push_back(std::move(decode));
+    }
+    if (rgbSources.empty()) {
+        std::mt19937 rng(42);
+        for (int i = 0; i < kSourceFrames; ++i) {
+            rgbSources.push_back(syntheticFrame(opts->cols * kSamplesX, opts->rows * kSamplesY, i, rng));
+        }
+    }
+    std::vector<VideoFrame> lumaSources;
+    for (const VideoFrame& frame : rgbSources) lumaSources.push_back(lumaFrame(frame));
+
+    // The encode and export stages reuse what the render stage produced.
+    bool needFrames = wantStage(*opts, "encode") || wantStage(*opts, "export");
+    std::vector<AsciiFrame> trueColorFrames;
+    std::vector<AsciiFrame> palette256Frames;
+    if (wantStage(*opts, "render") || needFrames) {
+        for (RenderMode mode : {RenderMode::Gray, RenderMode::ANSI256, RenderMode::TrueColor}) {
+            const auto& sources = mode == RenderMode::Gray ? lumaSources : rgbSources;
+            for (DitherMode dither : {DitherMode::Off, DitherMode::Bayer2, DitherMode::Bayer4, DitherMode::BlueNoise,
+                                      DitherMode::FloydSteinberg, DitherMode::Serpentine}) {
+                for (bool halfBlock : {false, true}) {
+                    std::vector<AsciiFrame>* keep = nullptr;
+                    if (dither == DitherMode::Bayer4 && !halfBlock) {
+                        if (mode == RenderMode::TrueColor) keep = &trueColorFrames;
+                        if (mode == RenderMode::ANSI256) keep = &palette256Frames;
+                    }
+                    if (!wantStage(*opts, "render") && !keep) continue;
+                    Result result = benchRender(*opts, sources, mode, dither, halfBlock, keep);
+                    if (wantStage(*opts, "render")) report.results.push_back(std::move(result));
+                }
+            }
+        }
+        // What export and caching pay: cells without the terminal string.
+        if (wantStage(*opts, "render")) {
+            RenderOutputs cellsOnly;
+            cellsOnly.terminalString = false;
+            report.results.push_back(benchRender(*opts, rgbSources, RenderMode::TrueColor, DitherMode::Bayer4,
+                                                 false, nullptr, cellsOnly));
+
+            // Mostly static content, rendered in full and incrementally.
+            std::vector<VideoFrame> screencast;
+            for (size_t i = 0; i < rgbSources.size(); ++i) {
+                screencast.push_back(screencastFrame(rgbSources.front(), static_cast<int>(i)));
+            }
+            for (bool incremental : {false, true}) {
+                Result result = benchRender(*opts, screencast, RenderMode::TrueColor, DitherMode::Bayer4, false,
+                                            nullptr, RenderOutputs{}, incremental);
+                result.variant += "/screencast";
+                report.results.push_back(std::move(result));
+            }
+        }
+    }
+
+    if (wantStage(*opts, "encode")) {
+        for (bool delta : {false, true}) {
+            report.results.push_back(benchEncode(*opts, palette256Frames, RenderMode::ANSI256, delta));
+            report.results.push_back(benchEncode(*opts, trueColorFrames, RenderMode::TrueColor, delta));
+        }
+    }
+    if (wantStage(*opts, "export")) {
+        report.results.push_back(benchExport(*opts, trueColorFrames));
+    }
+    if (wantStage(*opts, "audio")) {
+        report.results.push_back(benchAudio());
+    }
+
+    if (opts->json != "-") {
+        printTable(report);
+    }
+    if (opts->json == "-") {
+        writeJson(std::cout, *opts, report);
+    } else if (!opts->json.empty()) {
+        std::ofstream out(opts->json);
+        if (!out) {
+            std::cerr << "Cannot write " << opts->json << std::endl;
+            return 1;
+        }
+        writeJson(out, *opts, report);
+    }
+
+    return report.simdBitExact ? 0 : 1;
+}
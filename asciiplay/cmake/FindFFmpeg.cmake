@@ -23,4 +23,16 @@ set(FFMPEG_LIBRARIES ${FFMPEG_AVFORMAT_LIBRARY} ${FFMPEG_AVCODEC_LIBRARY} ${FFMP
 set(FFMPEG_INCLUDE_DIRS ${FFMPEG_INCLUDE_DIR})
 set(FFMPEG_DEFINITIONS "")
 
+# Optional: capture devices (v4l2, dshow, avfoundation) live in libavdevice.
+find_library(FFMPEG_AVDEVICE_LIBRARY
+    NAMES avdevice
+    HINTS ${PC_FFMPEG_LIBRARY_DIRS}
+)
+if (FFMPEG_AVDEVICE_LIBRARY)
+    list(INSERT FFMPEG_LIBRARIES 0 ${FFMPEG_AVDEVICE_LIBRARY})
+    list(APPEND FFMPEG_DEFINITIONS ASCIIPLAY_HAVE_AVDEVICE)
+else()
+    message(STATUS "libavdevice not found; capture device input disabled")
+endif()
+
 mark_as_advanced(FFMPEG_LIBRARIES FFMPEG_INCLUDE_DIRS)
@@ -0,0 +1,235 @@
+#include "ansi_encoder.hpp"
+
+#include <array>
+
+namespace asciiplay {
+
+namespace {
+
+// Unchanged cells shorter than this are rewritten rather than skipped, as a
+// cursor move costs about as many bytes as re-sending a few cells.
+constexpr int kMinSkipRun = 4;
+
+// Decimal spellings of 0..255 so colour components are a table copy.
+struct DecimalTable {
+    std::array<std::array<char, 4>, 256> text{};
+    std::array<uint8_t, 256> length{};
+};
+
+constexpr DecimalTable make_decimal_table()
+{
+    DecimalTable table{};
+    for (int v = 0; v < 256; ++v) {
+        int n = 0;
+        if (v >= 100) table.text[v][n++] = static_cast<char>('0' + v / 100);
+        if (v >= 10) table.text[v][n++] = static_cast<char>('0' + (v / 10) % 10);
+        table.text[v][n++] = static_cast<char>('0' + v % 10);
+        table.length[v] = static_cast<uint8_t>(n);
+    }
+    return table;
+}
+
+constexpr DecimalTable kDecimal = make_decimal_table();
+
+inline char* encode_byte(uint8_t value, char* out)
+{
+    // Always copy four bytes; the cursor only advances by the real length.
+    std::memcpy(out, kDecimal.text[value].data(), 4);
+    return out + kDecimal.length[value];
+}
+
+inline char* encode_rgb(const char (&prefix)[8], uint32_t color, char* out)
+{
+    out = encode_literal(prefix, out);
+    out = encode_byte(static_cast<uint8_t>((color >> 16) & 0xFF), out);
+    *out++ = ';';
+    out = encode_byte(static_cast<uint8_t>((color >> 8) & 0xFF), out);
+    *out++ = ';';
+    out = encode_byte(static_cast<uint8_t>(color & 0xFF), out);
+    *out++ = 'm';
+    return out;
+}
+
+inline char* encode_index(const char (&prefix)[8], uint8_t index, char* out)
+{
+    out = encode_literal(prefix, out);
+    out = encode_byte(index, out);
+    *out++ = 'm';
+    return out;
+}
+
+uint8_t palette_index(const AsciiCell& cell, uint32_t color, bool exact, const EncodeOptions& options)
+{
+    if (options.coarse) {
+        color = (color & 0xE0E0E0) | 0x101010;
+    } else if (exact) {
+        return cell.paletteIndex;
+    }
+    RGB rgb = unpack_rgb(color);
+    return xterm_index_fast(rgb.r, rgb.g, rgb.b);
+}
+
+char* encode_cells_palette(const AsciiCell* cells, int count, const EncodeOptions& options, char* out)
+{
+    // ANSI256 frames already carry the fg index; every other colour is mapped here.
+    const bool exactFg = options.mode == RenderMode::ANSI256;
+    int currentFg = -1;
+    int currentBg = -1;
+    for (int x = 0; x < count; ++x) {
+        const AsciiCell& cell = cells[x];
+        uint8_t fg = palette_index(cell, cell.fg, exactFg, options);
+        if (fg != currentFg) {
+            out = encode_index("\x1b[38;5;", fg, out);
+            currentFg = fg;
+        }
+        if (options.halfBlock) {
+            uint8_t bg = palette_index(cell, cell.bg, false, options);
+            if (bg != currentBg) {
+                out = encode_index("\x1b[48;5;", bg, out);
+                currentBg = bg;
+            }
+        }
+        out = encode_utf8(cell.glyph, out);
+    }
+    return out;
+}
+
+} // namespace
+
+char* encode_uint(uint32_t value, char* out)
+{
+    if (value < 256) return encode_byte(static_cast<uint8_t>(value), out);
+    char digits[10];
+    int n = 0;
+    while (value > 0) {
+        digits[n++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+    while (n > 0) *out++ = digits[--n];
+    return out;
+}
+
+char* encode_utf8(uint32_t code, char* out)
+{
+    if (code < 0x80) {
+        *out++ = static_cast<char>(code);
+    } else if (code < 0x800) {
+        *out++ = static_cast<char>(0xC0 | (code >> 6));
+        *out++ = static_cast<char>(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        *out++ = static_cast<char>(0xE0 | (code >> 12));
+        *out++ = static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        *out++ = static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+        *out++ = static_cast<char>(0xF0 | (code >> 18));
+        *out++ = static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+        *out++ = static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        *out++ = static_cast<char>(0x80 | (code & 0x3F));
+    }
+    return out;
+}
+
+char* encode_cursor_move(int row, int col, char* out)
+{
+    out = encode_literal("\x1b[", out);
+    out = encode_uint(static_cast<uint32_t>(row + 1), out);
+    *out++ = ';';
+    out = encode_uint(static_cast<uint32_t>(col + 1), out);
+    *out++ = 'H';
+    return out;
+}
+
+char* encode_cells(const AsciiCell* cells, int count, const EncodeOptions& options, char* out)
+{
+    if (options.monochrome) {
+        for (int x = 0; x < count; ++x) out = encode_utf8(cells[x].glyph, out);
+        return out;
+    }
+    if (options.palette256) {
+        return encode_cells_palette(cells, count, options, out);
+    }
+
+    // 0xFFFFFFFF never matches a packed 24-bit colour, so the first cell
+    // always sets its colours.
+    uint32_t currentFg = 0xFFFFFFFF;
+    uint32_t currentBg = 0xFFFFFFFF;
+    for (int x = 0; x < count; ++x) {
+        const AsciiCell& cell = cells[x];
+        if (options.mode == RenderMode::ANSI256) {
+            if (cell.paletteIndex != currentFg) {
+                out = encode_index("\x1b[38;5;", cell.paletteIndex, out);
+                currentFg = cell.paletteIndex;
+            }
+        } else if (cell.fg != currentFg) {
+            if (options.mode == RenderMode::Gray) {
+                uint32_t gray = (cell.fg >> 16) & 0xFF;
+                out = encode_rgb("\x1b[38;2;", gray * 0x010101u, out);
+            } else {
+                out = encode_rgb("\x1b[38;2;", cell.fg, out);
+            }
+            currentFg = cell.fg;
+        }
+
+        if (options.halfBlock && cell.bg != currentBg) {
+            out = encode_rgb("\x1b[48;2;", cell.bg, out);
+            currentBg = cell.bg;
+        }
+
+        out = encode_utf8(cell.glyph, out);
+    }
+    return out;
+}
+
+char* encode_rows(const AsciiFrame& frame, const EncodeOptions& options, int rowBegin, int rowEnd, char* out)
+{
+    for (int y = rowBegin; y < rowEnd; ++y) {
+        out = encode_cells(frame.cells.data() + static_cast<size_t>(y) * frame.cols, frame.cols, options, out);
+        out = encode_literal("\x1b[0m\r\n", out);
+    }
+    return out;
+}
+
+bool encode_delta(const AsciiFrame& frame, const AsciiFrame& previous, const EncodeOptions& options,
+                  size_t maxChanged, EncodeBuffer& out, const uint8_t* dirty)
+{
+    if (previous.cols != frame.cols || previous.rows != frame.rows ||
+        previous.halfBlock != frame.halfBlock || previous.mode != frame.mode ||
+        frame.cells.size() != previous.cells.size()) {
+        return false;
+    }
+
+    size_t changed = 0;
+    out.clear();
+    for (int y = 0; y < frame.rows; ++y) {
+        const AsciiCell* cur = frame.cells.data() + static_cast<size_t>(y) * frame.cols;
+        const AsciiCell* prev = previous.cells.data() + static_cast<size_t>(y) * frame.cols;
+        const uint8_t* rowDirty = dirty ? dirty + static_cast<size_t>(y) * frame.cols : nullptr;
+        auto same = [&](int x) { return (rowDirty && !rowDirty[x]) || same_cell(cur[x], prev[x]); };
+        int x = 0;
+        while (x < frame.cols) {
+            if (same(x)) {
+                ++x;
+                continue;
+            }
+            // Extend the run across short stretches of unchanged cells.
+            int end = x + 1;
+            int lastChanged = x;
+            while (end < frame.cols && end - lastChanged <= kMinSkipRun) {
+                if (!same(end)) lastChanged = end;
+                ++end;
+            }
+            end = lastChanged + 1;
+            changed += static_cast<size_t>(end - x);
+            if (changed > maxChanged) return false;
+
+            char* tail = out.reserveTail(kMaxCursorMoveBytes + max_encoded_cells(end - x));
+            tail = encode_cursor_move(y, x, tail);
+            out.commit(encode_cells(cur + x, end - x, options, tail));
+            x = end;
+        }
+    }
+    out.append("\x1b[0m", 4);
+    return true;
+}
+
+} // namespace asciiplay
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "ascii_renderer.hpp"
+#include "encode_buffer.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace asciiplay {
+
+struct EncodeOptions {
+    RenderMode mode = RenderMode::Gray;
+    bool halfBlock = false;
+    // Degraded output used by the terminal write governor: emit every colour
+    // as an xterm palette index, optionally pre-quantized to 3 bits per
+    // channel so that neighbouring cells share escapes more often.
+    bool palette256 = false;
+    bool coarse = false;
+    // Glyphs only, no colour escapes at all (for dumb network clients).
+    bool monochrome = false;
+};
+
+// Worst case per cell: a 24-bit fg and bg escape plus a 4-byte glyph.
+constexpr size_t kMaxEncodedCellBytes = 19 + 19 + 4;
+// "\x1b[0m\r\n" after every full row.
+constexpr size_t kEncodedRowEndBytes = 6;
+// "\x1b[<row>;<col>H" with two 10-digit numbers.
+constexpr size_t kMaxCursorMoveBytes = 24;
+// Number spellings are copied as fixed 4-byte blocks and may overrun the
+// real end by up to 3 bytes.
+constexpr size_t kEncodeSlackBytes = 4;
+
+inline size_t max_encoded_cells(int count)
+{
+    return static_cast<size_t>(count) * kMaxEncodedCellBytes + kEncodeSlackBytes;
+}
+
+inline size_t max_encoded_rows(int cols, int rows)
+{
+    return static_cast<size_t>(rows) * (max_encoded_cells(cols) + kEncodedRowEndBytes);
+}
+
+// The encoders write through a raw cursor into storage the caller sized with
+// the bounds above, and return the new end. Colour escapes are only emitted
+// when the colour changes; state starts fresh on every call, so a run can be
+// placed anywhere on screen after a cursor move.
+char* encode_cells(const AsciiCell* cells, int count, const EncodeOptions& options, char* out);
+
+// Whole rows, each terminated with an attribute reset and CRLF.
+char* encode_rows(const AsciiFrame& frame, const EncodeOptions& options, int rowBegin, int rowEnd, char* out);
+
+// Only the cells of `frame` that differ from `previous`, each run placed with
+// a cursor move and followed by an attribute reset. Returns false, leaving
+// `out` unspecified, when the layouts differ or more than `maxChanged` cells
+// changed; the caller then sends a full frame instead. With a `dirty` mask
+// (one byte per cell, see AsciiFrame::dirty) cells flagged zero are taken to
+// match `previous` without comparing them.
+bool encode_delta(const AsciiFrame& frame, const AsciiFrame& previous, const EncodeOptions& options,
+                  size_t maxChanged, EncodeBuffer& out, const uint8_t* dirty = nullptr);
+
+// Moves the cursor to a zero-based cell position.
+char* encode_cursor_move(int row, int col, char* out);
+
+char* encode_uint(uint32_t value, char* out);
+char* encode_utf8(uint32_t code, char* out);
+
+template <size_t N>
+inline char* encode_literal(const char (&text)[N], char* out)
+{
+    std::memcpy(out, text, N - 1);
+    return out + N - 1;
+}
+
+inline bool same_cell(const AsciiCell& a, const AsciiCell& b)
+{
+    return a.glyph == b.glyph && a.fg == b.fg && a.bg == b.bg;
+}
+
+} // namespace asciiplay
@@ -0,0 +1,387 @@
+#include "ascii_cache.hpp"
+#include "ansi_encoder.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace asciiplay {
+
+namespace {
+// Upper bound on the frames a reader must replay to reach any position.
+constexpr size_t kKeyFrameInterval = 120;
+constexpr size_t kWriteBufferBytes = 1 << 20;
+// Terminal strings in flight between the reader and the terminal.
+constexpr size_t kTextBuffers = 8;
+
+CacheCell pack_cell(const AsciiCell& cell)
+{
+    CacheCell packed{};
+    packed.glyph = cell.glyph;
+    packed.fg = cell.fg;
+    packed.bg = cell.bg;
+    packed.paletteIndex = cell.paletteIndex;
+    return packed;
+}
+
+AsciiCell unpack_cell(const CacheCell& packed)
+{
+    AsciiCell cell;
+    cell.glyph = packed.glyph;
+    cell.fg = packed.fg;
+    cell.bg = packed.bg;
+    cell.paletteIndex = packed.paletteIndex;
+    return cell;
+}
+
+bool same_cached_cell(const AsciiCell& a, const AsciiCell& b)
+{
+    return same_cell(a, b) && a.paletteIndex == b.paletteIndex;
+}
+
+template <typename T>
+void append_bytes(std::vector<uint8_t>& out, const T& value)
+{
+    const auto* bytes = reinterpret_cast<const uint8_t*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+bool same_layout(const AsciiFrame& a, const AsciiFrame& b)
+{
+    return a.cols == b.cols && a.rows == b.rows && a.mode == b.mode && a.halfBlock == b.halfBlock &&
+           a.cells.size() == b.cells.size();
+}
+}
+
+AsciiCacheWriter::~AsciiCacheWriter()
+{
+    std::string err;
+    close(err);
+}
+
+bool AsciiCacheWriter::open(const std::string& path, std::string& err)
+{
+    file_ = std::fopen(path.c_str(), "wb");
+    if (!file_) {
+        err = "Failed to open cache file";
+        return false;
+    }
+    fileBuffer_.resize(kWriteBufferBytes);
+    std::setvbuf(file_, fileBuffer_.data(), _IOFBF, fileBuffer_.size());
+
+    // The header is rewritten with the real counts on close().
+    CacheHeader header{};
+    std::memcpy(header.magic, kCacheMagic, sizeof(header.magic));
+    header.version = kCacheVersion;
+    header.compression = static_cast<uint32_t>(CacheCompression::None);
+    offset_ = 0;
+    index_.clear();
+    previous_ = AsciiFrame{};
+    sinceKeyFrame_ = 0;
+    return writeBytes(&header, sizeof(header), err);
+}
+
+bool AsciiCacheWriter::write(const AsciiFrame& frame, std::string& err)
+{
+    if (!file_) {
+        err = "Cache file not open";
+        return false;
+    }
+    if (frame.cols > UINT16_MAX || frame.rows > UINT16_MAX) {
+        err = "Grid too large for the cache format";
+        return false;
+    }
+
+    CacheFrameHeader header{};
+    header.pts = frame.pts;
+    header.cols = static_cast<uint16_t>(frame.cols);
+    header.rows = static_cast<uint16_t>(frame.rows);
+    header.mode = static_cast<uint8_t>(frame.mode);
+    header.halfBlock = frame.halfBlock ? 1 : 0;
+
+    payload_.clear();
+    bool key = index_.empty() || sinceKeyFrame_ + 1 >= kKeyFrameInterval || !same_layout(frame, previous_);
+    if (!key) {
+        size_t i = 0;
+        size_t count = frame.cells.size();
+        while (i < count) {
+            if (same_cached_cell(frame.cells[i], previous_.cells[i])) {
+                ++i;
+                continue;
+            }
+            size_t end = i + 1;
+            while (end < count && !same_cached_cell(frame.cells[end], previous_.cells[end])) ++end;
+            append_bytes(payload_, CacheRun{static_cast<uint32_t>(i), static_cast<uint32_t>(end - i)});
+            for (size_t c = i; c < end; ++c) append_bytes(payload_, pack_cell(frame.cells[c]));
+            ++header.runCount;
+            i = end;
+        }
+        // Busy frames can cost more as runs than as a plain key frame.
+        if (payload_.size() >= count * sizeof(CacheCell)) {
+            key = true;
+            payload_.clear();
+            header.runCount = 0;
+        }
+    }
+    if (key) {
+        for (const AsciiCell& cell : frame.cells) append_bytes(payload_, pack_cell(cell));
+        sinceKeyFrame_ = 0;
+    } else {
+        ++sinceKeyFrame_;
+    }
+    header.keyFrame = key ? 1 : 0;
+
+    CacheIndexEntry entry{};
+    entry.pts = frame.pts;
+    entry.offset = offset_;
+    entry.size = static_cast<uint32_t>(sizeof(header) + payload_.size());
+    entry.keyFrame = header.keyFrame;
+    if (!writeBytes(&header, sizeof(header), err) || !writeBytes(payload_.data(), payload_.size(), err)) {
+        return false;
+    }
+    index_.push_back(entry);
+
+    previous_.cols = frame.cols;
+    previous_.rows = frame.rows;
+    previous_.mode = frame.mode;
+    previous_.halfBlock = frame.halfBlock;
+    previous_.cells.assign(frame.cells.begin(), frame.cells.end());
+    return true;
+}
+
+bool AsciiCacheWriter::close(std::string& err)
+{
+    if (!file_) return true;
+    CacheHeader header{};
+    std::memcpy(header.magic, kCacheMagic, sizeof(header.magic));
+    header.version = kCacheVersion;
+    header.compression = static_cast<uint32_t>(CacheCompression::None);
+    header.frameCount = index_.size();
+    header.indexOffset = offset_;
+
+    bool ok = writeBytes(index_.data(), index_.size() * sizeof(CacheIndexEntry), err);
+    if (ok && (std::fseek(file_, 0, SEEK_SET) != 0 || std::fwrite(&header, sizeof(header), 1, file_) != 1)) {
+        err = "Failed to finish cache file";
+        ok = false;
+    }
+    if (std::fclose(file_) != 0 && ok) {
+        err = "Failed to finish cache file";
+        ok = false;
+    }
+    file_ = nullptr;
+    return ok;
+}
+
+bool AsciiCacheWriter::writeBytes(const void* data, size_t size, std::string& err)
+{
+    if (size == 0) return true;
+    if (std::fwrite(data, 1, size, file_) != size) {
+        err = "Failed to write cache file";
+        return false;
+    }
+    offset_ += size;
+    return true;
+}
+
+AsciiCacheReader::AsciiCacheReader()
+    : textPool_(kTextBuffers)
+{
+}
+
+AsciiCacheReader::~AsciiCacheReader()
+{
+    close();
+}
+
+bool AsciiCacheReader::probe(const std::string& path)
+{
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) return false;
+    char magic[sizeof(kCacheMagic)] = {};
+    bool match = std::fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                 std::memcmp(magic, kCacheMagic, sizeof(magic)) == 0;
+    std::fclose(file);
+    return match;
+}
+
+bool AsciiCacheReader::open(const std::string& path, std::string& err)
+{
+    close();
+#ifdef _WIN32
+    file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                        FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) {
+        err = "Failed to open cache file";
+        return false;
+    }
+    LARGE_INTEGER fileSize{};
+    GetFileSizeEx(file_, &fileSize);
+    size_ = static_cast<size_t>(fileSize.QuadPart);
+    mapping_ = size_ > 0 ? CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+    data_ = mapping_ ? static_cast<const uint8_t*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+#else
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        err = "Failed to open cache file";
+        return false;
+    }
+    struct stat st{};
+    if (::fstat(fd_, &st) == 0) size_ = static_cast<size_t>(st.st_size);
+    if (size_ > 0) {
+        void* mapped = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (mapped != MAP_FAILED) {
+            data_ = static_cast<const uint8_t*>(mapped);
+            ::madvise(mapped, size_, MADV_SEQUENTIAL);
+        }
+    }
+#endif
+    if (!data_) {
+        err = "Failed to map cache file";
+        close();
+        return false;
+    }
+
+    CacheHeader header{};
+    if (size_ < sizeof(header)) {
+        err = "Truncated cache file";
+        close();
+        return false;
+    }
+    std::memcpy(&header, data_, sizeof(header));
+    if (std::memcmp(header.magic, kCacheMagic, sizeof(header.magic)) != 0 || header.version != kCacheVersion) {
+        err = "Not a supported cache file";
+        close();
+        return false;
+    }
+    if (header.compression != static_cast<uint32_t>(CacheCompression::None)) {
+        err = "Unsupported cache compression";
+        close();
+        return false;
+    }
+    if (header.indexOffset < sizeof(header) || header.indexOffset > size_ ||
+        header.frameCount > (size_ - header.indexOffset) / sizeof(CacheIndexEntry)) {
+        err = "Cache file was not finished or is damaged";
+        close();
+        return false;
+    }
+    index_ = reinterpret_cast<const CacheIndexEntry*>(data_ + header.indexOffset);
+    frameCount_ = static_cast<size_t>(header.frameCount);
+    nextFrame_ = 0;
+    haveCurrent_ = false;
+
+    if (frameCount_ > 0 && index_[0].offset + sizeof(CacheFrameHeader) <= header.indexOffset) {
+        CacheFrameHeader first{};
+        std::memcpy(&first, data_ + index_[0].offset, sizeof(first));
+        firstCols_ = first.cols;
+        firstRows_ = first.rows;
+    }
+    return true;
+}
+
+void AsciiCacheReader::close()
+{
+#ifdef _WIN32
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_) CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+    mapping_ = nullptr;
+    file_ = INVALID_HANDLE_VALUE;
+#else
+    if (data_) ::munmap(const_cast<uint8_t*>(data_), size_);
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+#endif
+    data_ = nullptr;
+    size_ = 0;
+    index_ = nullptr;
+    frameCount_ = 0;
+    nextFrame_ = 0;
+    haveCurrent_ = false;
+}
+
+double AsciiCacheReader::duration() const
+{
+    return frameCount_ > 0 ? index_[frameCount_ - 1].pts : 0.0;
+}
+
+bool AsciiCacheReader::next(AsciiFrame& frame, const RenderOutputs& outputs)
+{
+    if (nextFrame_ >= frameCount_) return false;
+    if (!applyRecord(index_[nextFrame_])) {
+        std::cerr << "Cache frame " << nextFrame_ << " is damaged, stopping" << std::endl;
+        nextFrame_ = frameCount_;
+        return false;
+    }
+    ++nextFrame_;
+
+    frame.cols = current_.cols;
+    frame.rows = current_.rows;
+    frame.mode = current_.mode;
+    frame.halfBlock = current_.halfBlock;
+    frame.pts = current_.pts;
+    frame.cells = current_.cells;
+    if (!outputs.terminalString) return true;
+
+    static constexpr char kHome[] = "\x1b[H";
+    frame.terminalString = textPool_.acquire(sizeof(kHome) - 1 + max_encoded_rows(frame.cols, frame.rows));
+    char* out = encode_literal(kHome, frame.terminalString.data());
+    out = encode_rows(frame, EncodeOptions{frame.mode, frame.halfBlock}, 0, frame.rows, out);
+    frame.terminalString.resize(static_cast<size_t>(out - frame.terminalString.data()));
+    return true;
+}
+
+bool AsciiCacheReader::applyRecord(const CacheIndexEntry& entry)
+{
+    if (entry.offset > size_ || entry.size < sizeof(CacheFrameHeader) || entry.size > size_ - entry.offset) {
+        return false;
+    }
+    const uint8_t* record = data_ + entry.offset;
+    const uint8_t* end = record + entry.size;
+    CacheFrameHeader header{};
+    std::memcpy(&header, record, sizeof(header));
+    const uint8_t* cursor = record + sizeof(header);
+
+    size_t count = static_cast<size_t>(header.cols) * header.rows;
+    if (header.keyFrame) {
+        if (static_cast<size_t>(end - cursor) != count * sizeof(CacheCell)) return false;
+        current_.cols = header.cols;
+        current_.rows = header.rows;
+        current_.mode = static_cast<RenderMode>(header.mode);
+        current_.halfBlock = header.halfBlock != 0;
+        current_.cells.resize(count);
+        for (size_t i = 0; i < count; ++i, cursor += sizeof(CacheCell)) {
+            CacheCell packed;
+            std::memcpy(&packed, cursor, sizeof(packed));
+            current_.cells[i] = unpack_cell(packed);
+        }
+        haveCurrent_ = true;
+    } else {
+        if (!haveCurrent_ || header.cols != current_.cols || header.rows != current_.rows) return false;
+        for (uint32_t r = 0; r < header.runCount; ++r) {
+            CacheRun run;
+            if (static_cast<size_t>(end - cursor) < sizeof(run)) return false;
+            std::memcpy(&run, cursor, sizeof(run));
+            cursor += sizeof(run);
+            if (run.start > count || run.count > count - run.start ||
+                static_cast<size_t>(end - cursor) < static_cast<size_t>(run.count) * sizeof(CacheCell)) {
+                return false;
+            }
+            for (uint32_t i = 0; i < run.count; ++i, cursor += sizeof(CacheCell)) {
+                CacheCell packed;
+                std::memcpy(&packed, cursor, sizeof(packed));
+                current_.cells[run.start + i] = unpack_cell(packed);
+            }
+        }
+    }
+    current_.pts = header.pts;
+    return true;
+}
+
+} // namespace asciiplay
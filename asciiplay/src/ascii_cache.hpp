@@ -0,0 +1,163 @@
+#pragma once
+
+#include "ascii_renderer.hpp"
+#include "frame_pool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace asciiplay {
+
+// .asciicache layout, in host byte order (little-endian on every target we
+// build for):
+//
+//   CacheHeader
+//   one record per frame: CacheFrameHeader, then its cell payload
+//   CacheIndexEntry[frameCount], starting at CacheHeader::indexOffset
+//
+// A key frame stores every cell. Any other frame stores runs of cells that
+// changed since the previous frame, each a CacheRun followed by that many
+// CacheCells. A change of grid size, mode or half-block always starts a key
+// frame, and key frames recur regularly so playback can start mid-file.
+constexpr char kCacheMagic[8] = {'A', 'S', 'C', 'I', 'I', 'C', 'C', '1'};
+constexpr uint32_t kCacheVersion = 1;
+
+// Payload compression named in the header. Only raw payloads exist today;
+// readers reject anything else rather than misread it.
+enum class CacheCompression : uint32_t {
+    None = 0
+};
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t compression;
+    uint64_t frameCount;  // 0 until the writer is closed
+    uint64_t indexOffset; // 0 until the writer is closed
+};
+
+struct CacheFrameHeader {
+    double pts;
+    uint16_t cols;
+    uint16_t rows;
+    uint8_t mode; // RenderMode
+    uint8_t halfBlock;
+    uint8_t keyFrame;
+    uint8_t reserved;
+    uint32_t runCount; // 0 for key frames
+    uint32_t reserved2;
+};
+
+struct CacheRun {
+    uint32_t start;
+    uint32_t count;
+};
+
+// AsciiCell with its padding pinned to zero, so files are reproducible.
+struct CacheCell {
+    uint32_t glyph;
+    uint32_t fg;
+    uint32_t bg;
+    uint8_t paletteIndex;
+    uint8_t reserved[3];
+};
+
+struct CacheIndexEntry {
+    double pts;
+    uint64_t offset; // of the CacheFrameHeader
+    uint32_t size;   // header plus payload
+    uint32_t keyFrame;
+};
+
+static_assert(sizeof(CacheHeader) == 32, "CacheHeader layout is part of the file format");
+static_assert(sizeof(CacheFrameHeader) == 24, "CacheFrameHeader layout is part of the file format");
+static_assert(sizeof(CacheCell) == 16, "CacheCell layout is part of the file format");
+static_assert(sizeof(CacheIndexEntry) == 24, "CacheIndexEntry layout is part of the file format");
+static_assert(std::is_trivially_copyable<CacheFrameHeader>::value, "cache records are copied as bytes");
+
+// Appends rendered frames to a cache file. Frames must arrive in play order.
+class AsciiCacheWriter {
+public:
+    AsciiCacheWriter() = default;
+    ~AsciiCacheWriter();
+
+    AsciiCacheWriter(const AsciiCacheWriter&) = delete;
+    AsciiCacheWriter& operator=(const AsciiCacheWriter&) = delete;
+
+    bool open(const std::string& path, std::string& err);
+    bool write(const AsciiFrame& frame, std::string& err);
+    // Writes the index and fills in the header; until then the file is not
+    // playable.
+    bool close(std::string& err);
+    bool isOpen() const { return file_ != nullptr; }
+
+private:
+    bool writeBytes(const void* data, size_t size, std::string& err);
+
+    std::FILE* file_ = nullptr;
+    std::vector<char> fileBuffer_;
+    uint64_t offset_ = 0;
+    std::vector<CacheIndexEntry> index_;
+    AsciiFrame previous_; // cells and layout only
+    size_t sinceKeyFrame_ = 0;
+    std::vector<uint8_t> payload_;
+};
+
+// Plays a cache file straight out of a read-only memory map.
+class AsciiCacheReader {
+public:
+    AsciiCacheReader();
+    ~AsciiCacheReader();
+
+    AsciiCacheReader(const AsciiCacheReader&) = delete;
+    AsciiCacheReader& operator=(const AsciiCacheReader&) = delete;
+
+    // True when the file starts with the cache magic.
+    static bool probe(const std::string& path);
+
+    bool open(const std::string& path, std::string& err);
+    void close();
+    size_t frameCount() const { return frameCount_; }
+    // Timestamp of the last frame, in seconds.
+    double duration() const;
+    // Layout of the first frame, used to size the terminal before playback.
+    int cols() const { return firstCols_; }
+    int rows() const { return firstRows_; }
+
+    // Rebuilds the next frame's cells, and its terminal string if asked to;
+    // false at the end or on a damaged record.
+    bool next(AsciiFrame& frame, const RenderOutputs& outputs = RenderOutputs{});
+
+private:
+    bool applyRecord(const CacheIndexEntry& entry);
+
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    const CacheIndexEntry* index_ = nullptr;
+    size_t frameCount_ = 0;
+    size_t nextFrame_ = 0;
+    int firstCols_ = 0;
+    int firstRows_ = 0;
+
+    // Cell state the delta records apply to.
+    AsciiFrame current_;
+    bool haveCurrent_ = false;
+    FramePool<char> textPool_;
+
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+};
+
+} // namespace asciiplay
@@ -1,26 +1,55 @@
 #include "ascii_renderer.hpp"
+#include "ansi_encoder.hpp"
+#include "simd_kernels.hpp"
+
 #include <string_view>
 #include <algorithm>
 #include <array>
 #include <cmath>
+#include <cstring>
 #include <numeric>
+#include <thread>
 
 namespace asciiplay {
 
 namespace {
 constexpr std::string_view kRamp = "@%#*+=-:. ";
+// A few bands per worker keeps the pool busy when rows cost unevenly.
+constexpr size_t kBandsPerThread = 4;
+// Terminal strings in flight between the renderer and the terminal.
+constexpr size_t kTextBuffers = 8;
+constexpr uint32_t kLowerHalfBlock = 0x2584; // ▄
+constexpr size_t kDiffusionChannels = 4;
+// Past a quarter of a row dirty, one vector pass over the strip beats
+// sampling the cells one by one.
+constexpr int kSparseDirtyDivisor = 4;
+
+// Upper cell's colour becomes the background, the lower one's the foreground.
+void combineHalfBlocks(AsciiCell* row, const AsciiCell* lower, int cols)
+{
+    for (int x = 0; x < cols; ++x) {
+        AsciiCell& cell = row[x];
+        cell.glyph = kLowerHalfBlock;
+        cell.bg = cell.fg;
+        cell.fg = lower[x].fg;
+        cell.paletteIndex = lower[x].paletteIndex;
+    }
+}
 }
 
 AsciiRenderer::AsciiRenderer()
+    : textPool_(kTextBuffers)
 {
-    buildRamp();
+    rebuildTables();
+    // Build the quantization table up front so the first frame doesn't pay for it.
+    xterm_lut();
 }
 
 void AsciiRenderer::configure(const RendererConfig& cfg)
 {
     std::lock_guard<std::mutex> lock(mutex_);
     config_ = cfg;
-    buildRamp();
+    rebuildTables();
 }
 
 RendererConfig AsciiRenderer::config() const
@@ -56,6 +85,15 @@ void AsciiRenderer::cycleDither()
         config_.dither = DitherMode::Bayer4;
         break;
     case DitherMode::Bayer4:
+        config_.dither = DitherMode::BlueNoise;
+        break;
+    case DitherMode::BlueNoise:
+        config_.dither = DitherMode::FloydSteinberg;
+        break;
+    case DitherMode::FloydSteinberg:
+        config_.dither = DitherMode::Serpentine;
+        break;
+    case DitherMode::Serpentine:
         config_.dither = DitherMode::Off;
         break;
     }
@@ -65,177 +103,436 @@ void AsciiRenderer::adjustGamma(float delta)
 {
     std::lock_guard<std::mutex> lock(mutex_);
     config_.gamma = std::clamp(config_.gamma + delta, 0.5f, 4.0f);
+    rebuildTables();
 }
 
 void AsciiRenderer::adjustContrast(float delta)
 {
     std::lock_guard<std::mutex> lock(mutex_);
     config_.contrast = std::clamp(config_.contrast + delta, 0.2f, 3.0f);
+    rebuildTables();
 }
 
-void AsciiRenderer::buildRamp()
+void AsciiRenderer::rebuildTables()
 {
-    ramp_.assign(kRamp.begin(), kRamp.end());
+    auto tone = std::make_shared<ToneTable>();
+    int last = static_cast<int>(kRamp.size()) - 1;
+    for (size_t i = 0; i < ToneTable::kSize; ++i) {
+        float luma = static_cast<float>(i) / ToneTable::kStepsPerLevel;
+        float level = apply_contrast(apply_gamma(luma, config_.gamma), config_.contrast);
+        int rampIndex = std::clamp(static_cast<int>(level * last + 0.5f), 0, last);
+        tone->level[i] = level;
+        tone->glyph[i] = kRamp[rampIndex];
+    }
+    tone_ = std::move(tone);
 }
 
-AsciiCell AsciiRenderer::sampleCell(const uint8_t* rgb, int width, int height, int startX, int startY,
+// Clamped per-pixel sampling, only used where a cell row leaves the frame.
+AsciiCell AsciiRenderer::sampleCell(const RendererConfig& cfg, const ToneTable& tone, const uint8_t* rgb,
+                                    int width, int height, int startX, int startY,
                                     int cellWidth, int cellHeight, int row, int col) const
 {
-    const BayerMatrix& matrix = bayer_matrix(config_.dither);
-    float accumLuma = 0.0f;
-    float accumR = 0.0f;
-    float accumG = 0.0f;
-    float accumB = 0.0f;
-    int count = 0;
+    uint32_t accumR = 0;
+    uint32_t accumG = 0;
+    uint32_t accumB = 0;
     for (int y = 0; y < cellHeight; ++y) {
         int yy = std::clamp(startY + y, 0, height - 1);
         for (int x = 0; x < cellWidth; ++x) {
             int xx = std::clamp(startX + x, 0, width - 1);
             const uint8_t* pixel = rgb + (yy * width + xx) * 3;
-            accumLuma += luminance(pixel[0], pixel[1], pixel[2]);
             accumR += pixel[0];
             accumG += pixel[1];
             accumB += pixel[2];
-            ++count;
         }
     }
+    return shadeRgb(cfg, tone, accumR, accumG, accumB, static_cast<uint32_t>(cellWidth * cellHeight), row, col);
+}
 
-    float avgLuma = accumLuma / std::max(1, count);
-    float normalized = apply_gamma(avgLuma, config_.gamma);
-    normalized = apply_contrast(normalized, config_.contrast);
-
-    int rampIndex = static_cast<int>(normalized * (ramp_.size() - 1) + 0.5f);
-    rampIndex = std::clamp(rampIndex, 0, static_cast<int>(ramp_.size()) - 1);
+AsciiCell AsciiRenderer::sampleLumaCell(const RendererConfig& cfg, const ToneTable& tone, const uint8_t* luma,
+                                        int width, int height, int startX, int startY,
+                                        int cellWidth, int cellHeight, int row, int col) const
+{
+    uint32_t sum = 0;
+    for (int y = 0; y < cellHeight; ++y) {
+        const uint8_t* line = luma + static_cast<size_t>(std::clamp(startY + y, 0, height - 1)) * width;
+        for (int x = startX; x < startX + cellWidth; ++x) sum += line[std::clamp(x, 0, width - 1)];
+    }
+    return shadeLuma(cfg, tone, sum, static_cast<uint32_t>(cellWidth * cellHeight), row, col);
+}
 
-    float threshold = 0.0f;
-    if (matrix.size > 1) {
-        int idx = (row % matrix.size) * matrix.size + (col % matrix.size);
-        threshold = matrix.thresholds[idx];
+AsciiCell AsciiRenderer::sampleCellAt(const RendererConfig& cfg, const ToneTable& tone, const VideoFrame& frame,
+                                      int startX, int startY, int cellWidth, int cellHeight, int row, int col) const
+{
+    if (frame.format == AV_PIX_FMT_GRAY8) {
+        return sampleLumaCell(cfg, tone, frame.data.data(), frame.width, frame.height,
+                              startX, startY, cellWidth, cellHeight, row, col);
     }
+    return sampleCell(cfg, tone, frame.data.data(), frame.width, frame.height,
+                      startX, startY, cellWidth, cellHeight, row, col);
+}
 
-    AsciiCell cell;
-    cell.glyph = std::string(1, ramp_[rampIndex]);
+AsciiCell AsciiRenderer::shadeRgb(const RendererConfig& cfg, const ToneTable& tone, uint32_t sumR, uint32_t sumG,
+                                  uint32_t sumB, uint32_t count, int row, int col) const
+{
+    // Luminance is linear, so the average of it is the luminance of the average.
+    float avgLuma = (0.2126f * sumR + 0.7152f * sumG + 0.0722f * sumB) / count;
+    size_t toneIndex = std::min(static_cast<size_t>(avgLuma * ToneTable::kStepsPerLevel + 0.5f),
+                                ToneTable::kSize - 1);
+    uint8_t avgR = static_cast<uint8_t>(sumR / count);
+    uint8_t avgG = static_cast<uint8_t>(sumG / count);
+    uint8_t avgB = static_cast<uint8_t>(sumB / count);
+    return shadeCell(cfg, tone, toneIndex, static_cast<uint8_t>(avgLuma), avgR, avgG, avgB, row, col);
+}
 
-    uint8_t avgR = static_cast<uint8_t>(accumR / std::max(1, count));
-    uint8_t avgG = static_cast<uint8_t>(accumG / std::max(1, count));
-    uint8_t avgB = static_cast<uint8_t>(accumB / std::max(1, count));
+AsciiCell AsciiRenderer::shadeLuma(const RendererConfig& cfg, const ToneTable& tone, uint32_t sum, uint32_t count,
+                                   int row, int col) const
+{
+    uint8_t gray = static_cast<uint8_t>(sum / count);
+    return shadeCell(cfg, tone, static_cast<size_t>(gray) * ToneTable::kStepsPerLevel,
+                     gray, gray, gray, gray, row, col);
+}
 
-    if (config_.mode == RenderMode::Gray) {
-        uint8_t gray = static_cast<uint8_t>(avgLuma);
+AsciiCell AsciiRenderer::shadeCell(const RendererConfig& cfg, const ToneTable& tone, size_t toneIndex,
+                                   uint8_t gray, uint8_t r, uint8_t g, uint8_t b, int row, int col) const
+{
+    float level = tone.level[toneIndex];
+    float threshold = threshold_map(cfg.dither).at(row, col);
+
+    AsciiCell cell;
+    cell.glyph = static_cast<unsigned char>(tone.glyph[toneIndex]);
+
+    if (cfg.mode == RenderMode::Gray) {
         cell.fg = pack_rgb(gray, gray, gray);
         cell.bg = pack_rgb(0, 0, 0);
-    } else if (config_.mode == RenderMode::ANSI256) {
-        int idx = xterm_index_from_rgb(avgR, avgG, avgB);
+    } else if (cfg.mode == RenderMode::ANSI256) {
+        uint8_t idx = xterm_index_fast(r, g, b);
         const auto& rgbPalette = xterm_palette()[idx];
         cell.fg = pack_rgb(rgbPalette.r, rgbPalette.g, rgbPalette.b);
+        cell.paletteIndex = idx;
         cell.bg = pack_rgb(0, 0, 0);
-        if (normalized + threshold > 1.0f) {
-            cell.glyph = "#";
+        if (level + threshold > 1.0f) {
+            cell.glyph = '#';
         }
     } else {
-        cell.fg = pack_rgb(avgR, avgG, avgB);
+        cell.fg = pack_rgb(r, g, b);
         cell.bg = pack_rgb(0, 0, 0);
     }
     return cell;
 }
 
-AsciiFrame AsciiRenderer::render(const VideoFrame& frame)
+void AsciiRenderer::sampleCellRow(const RendererConfig& cfg, const ToneTable& tone, const VideoFrame& frame,
+                                  int startY, int cellWidth, int cellHeight, int ditherRow,
+                                  std::vector<uint16_t>& columnSums, AsciiCell* out) const
 {
-    RendererConfig cfg = config();
+    bool luma = frame.format == AV_PIX_FMT_GRAY8;
+    int cols = cfg.gridCols;
+    bool interior = startY + cellHeight <= frame.height && cols * cellWidth <= frame.width
+                    && cellHeight <= kMaxColumnRows;
+    if (!interior) {
+        for (int x = 0; x < cols; ++x) {
+            out[x] = sampleCellAt(cfg, tone, frame, x * cellWidth, startY, cellWidth, cellHeight, ditherRow, x);
+        }
+        return;
+    }
 
-    AsciiFrame ascii;
-    ascii.cols = cfg.gridCols;
-    ascii.rows = cfg.gridRows;
-    ascii.halfBlock = cfg.halfBlock;
-    ascii.pts = frame.pts;
-    ascii.cells.resize(ascii.cols * ascii.rows);
+    // Sum the whole strip vertically in one vector pass, then each cell
+    // only adds up cellWidth column totals per channel.
+    size_t channels = luma ? 1 : 3;
+    size_t stride = frame.width * channels;
+    int bytes = static_cast<int>(cols * cellWidth * channels);
+    columnSums.resize(bytes);
+    simd_kernels().columnSums(frame.data.data() + startY * stride, stride, cellHeight, bytes, columnSums.data());
 
+    uint32_t count = static_cast<uint32_t>(cellWidth * cellHeight);
+    const uint16_t* sums = columnSums.data();
+    for (int x = 0; x < cols; ++x) {
+        if (luma) {
+            uint32_t sum = 0;
+            for (int i = 0; i < cellWidth; ++i) sum += sums[i];
+            out[x] = shadeLuma(cfg, tone, sum, count, ditherRow, x);
+        } else {
+            uint32_t sumR = 0;
+            uint32_t sumG = 0;
+            uint32_t sumB = 0;
+            for (int i = 0; i < cellWidth * 3; i += 3) {
+                sumR += sums[i];
+                sumG += sums[i + 1];
+                sumB += sums[i + 2];
+            }
+            out[x] = shadeRgb(cfg, tone, sumR, sumG, sumB, count, ditherRow, x);
+        }
+        sums += cellWidth * channels;
+    }
+}
+
+void AsciiRenderer::sampleRows(const RendererConfig& cfg, const ToneTable& tone, const VideoFrame& frame,
+                               AsciiFrame& ascii, int rowBegin, int rowEnd, BandScratch& scratch) const
+{
     int cellWidth = frame.width / cfg.gridCols;
     int cellHeight = frame.height / (cfg.halfBlock ? cfg.gridRows * 2 : cfg.gridRows);
     cellWidth = std::max(1, cellWidth);
     cellHeight = std::max(1, cellHeight);
 
-    for (int y = 0; y < ascii.rows; ++y) {
-        for (int x = 0; x < ascii.cols; ++x) {
-            int startY = cfg.halfBlock ? y * 2 * cellHeight : y * cellHeight;
-            AsciiCell cellTop = sampleCell(frame.data.data(), frame.width, frame.height,
-                                           x * cellWidth, startY, cellWidth, cellHeight,
-                                           y, x);
-            AsciiCell cell = cellTop;
-            if (cfg.halfBlock) {
-                AsciiCell cellBottom = sampleCell(frame.data.data(), frame.width, frame.height,
-                                                  x * cellWidth, startY + cellHeight,
-                                                  cellWidth, cellHeight, y + 1, x);
-                cell.glyph = u8"▄";
-                cell.bg = cellTop.fg;
-                cell.fg = cellBottom.fg;
+    // Diffusion quantizes afterwards, so it samples the plain average colour
+    // and keeps the lower half rows apart until they have been diffused too.
+    bool diffuse = is_error_diffusion(cfg.dither);
+    RendererConfig sampleCfg = cfg;
+    if (diffuse) sampleCfg.mode = RenderMode::TrueColor;
+    if (cfg.halfBlock) {
+        scratch.lowerCells.resize(static_cast<size_t>(diffuse ? rowEnd - rowBegin : 1) * ascii.cols);
+    }
+
+    for (int y = rowBegin; y < rowEnd; ++y) {
+        AsciiCell* row = ascii.cells.data() + y * ascii.cols;
+        if (reusePrevious_) {
+            int lines = cfg.halfBlock ? 2 * cellHeight : cellHeight;
+            int changed = markDirtyCells(frame, y * lines, (y + 1) * lines, cellWidth, ascii.cols,
+                                         ascii.dirty.data() + y * ascii.cols);
+            // Clean cells come out the same either way, so the mask holds
+            // whichever path fills the row.
+            if (changed * kSparseDirtyDivisor <= ascii.cols) {
+                resampleDirtyCells(cfg, tone, frame, ascii, y, cellWidth, cellHeight);
+                continue;
             }
-            ascii.cells[y * ascii.cols + x] = cell;
         }
+        if (!cfg.halfBlock) {
+            sampleCellRow(sampleCfg, tone, frame, y * cellHeight, cellWidth, cellHeight, y, scratch.columnSums, row);
+            continue;
+        }
+        int startY = y * 2 * cellHeight;
+        AsciiCell* lower = scratch.lowerCells.data() + (diffuse ? (y - rowBegin) * ascii.cols : 0);
+        sampleCellRow(sampleCfg, tone, frame, startY, cellWidth, cellHeight, y, scratch.columnSums, row);
+        sampleCellRow(sampleCfg, tone, frame, startY + cellHeight, cellWidth, cellHeight, y + 1,
+                      scratch.columnSums, lower);
+        if (!diffuse) combineHalfBlocks(row, lower, ascii.cols);
     }
+}
 
-    // Build terminal string.
-    std::string buffer;
-    buffer.reserve(ascii.cols * ascii.rows * 8);
-    buffer.append("\x1b[H");
-    const auto flushTrueColor = [&](uint32_t color) {
-        RGB rgb = unpack_rgb(color);
-        buffer.append("\x1b[38;2;");
-        buffer.append(std::to_string(rgb.r));
-        buffer.push_back(';');
-        buffer.append(std::to_string(rgb.g));
-        buffer.push_back(';');
-        buffer.append(std::to_string(rgb.b));
-        buffer.push_back('m');
-    };
-
-    for (int y = 0; y < ascii.rows; ++y) {
-        uint32_t currentFg = 0xFFFFFFFF;
-        uint32_t currentBg = 0x00000000;
-        bool haveColor = false;
-        for (int x = 0; x < ascii.cols; ++x) {
-            const AsciiCell& cell = ascii.cells[y * ascii.cols + x];
-            if (cfg.mode == RenderMode::TrueColor) {
-                if (!haveColor || cell.fg != currentFg) {
-                    flushTrueColor(cell.fg);
-                    currentFg = cell.fg;
-                    haveColor = true;
-                }
-            } else if (cfg.mode == RenderMode::ANSI256) {
-                int idx = xterm_index_from_rgb((cell.fg >> 16) & 0xFF, (cell.fg >> 8) & 0xFF, cell.fg & 0xFF);
-                buffer.append("\x1b[38;5;");
-                buffer.append(std::to_string(idx));
-                buffer.push_back('m');
-            } else {
-                uint8_t gray = static_cast<uint8_t>((cell.fg >> 16) & 0xFF);
-                buffer.append("\x1b[38;2;");
-                buffer.append(std::to_string(gray));
-                buffer.push_back(';');
-                buffer.append(std::to_string(gray));
-                buffer.push_back(';');
-                buffer.append(std::to_string(gray));
-                buffer.push_back('m');
+int AsciiRenderer::markDirtyCells(const VideoFrame& frame, int lineBegin, int lineEnd, int cellWidth, int cols,
+                                  uint8_t* dirty) const
+{
+    size_t channels = frame.format == AV_PIX_FMT_GRAY8 ? 1 : 3;
+    size_t stride = frame.width * channels;
+    // The same clamping as the samplers, so edge cells compare the pixels
+    // they actually read.
+    int first = std::clamp(lineBegin, 0, frame.height - 1);
+    int last = std::clamp(lineEnd - 1, 0, frame.height - 1);
+    std::fill(dirty, dirty + cols, uint8_t{0});
+    int changed = 0;
+    for (int line = first; line <= last && changed < cols; ++line) {
+        const uint8_t* cur = frame.data.data() + line * stride;
+        const uint8_t* prev = previousSource_.data.data() + line * stride;
+        if (std::memcmp(cur, prev, stride) == 0) continue;
+        for (int x = 0; x < cols; ++x) {
+            if (dirty[x]) continue;
+            int begin = std::min(x * cellWidth, frame.width - 1);
+            int end = std::min(x * cellWidth + cellWidth, frame.width);
+            if (std::memcmp(cur + begin * channels, prev + begin * channels, (end - begin) * channels) != 0) {
+                dirty[x] = 1;
+                ++changed;
             }
+        }
+    }
+    return changed;
+}
 
-            if (cfg.halfBlock) {
-                if (!haveColor || cell.bg != currentBg) {
-                    RGB rgb = unpack_rgb(cell.bg);
-                    buffer.append("\x1b[48;2;");
-                    buffer.append(std::to_string(rgb.r));
-                    buffer.push_back(';');
-                    buffer.append(std::to_string(rgb.g));
-                    buffer.push_back(';');
-                    buffer.append(std::to_string(rgb.b));
-                    buffer.push_back('m');
-                    currentBg = cell.bg;
-                }
-            }
+void AsciiRenderer::resampleDirtyCells(const RendererConfig& cfg, const ToneTable& tone, const VideoFrame& frame,
+                                       AsciiFrame& ascii, int y, int cellWidth, int cellHeight) const
+{
+    size_t offset = static_cast<size_t>(y) * ascii.cols;
+    AsciiCell* row = ascii.cells.data() + offset;
+    const uint8_t* dirty = ascii.dirty.data() + offset;
+    std::copy(previousCells_.begin() + offset, previousCells_.begin() + offset + ascii.cols, row);
+    for (int x = 0; x < ascii.cols; ++x) {
+        if (!dirty[x]) continue;
+        if (!cfg.halfBlock) {
+            row[x] = sampleCellAt(cfg, tone, frame, x * cellWidth, y * cellHeight, cellWidth, cellHeight, y, x);
+            continue;
+        }
+        int startY = y * 2 * cellHeight;
+        AsciiCell lower = sampleCellAt(cfg, tone, frame, x * cellWidth, startY + cellHeight, cellWidth, cellHeight,
+                                       y + 1, x);
+        row[x] = sampleCellAt(cfg, tone, frame, x * cellWidth, startY, cellWidth, cellHeight, y, x);
+        combineHalfBlocks(row + x, &lower, 1);
+    }
+}
+
+// Floyd-Steinberg on one row of sampled cells: the colour goes through the
+// xterm palette in ANSI256 mode and the tone level through the glyph ramp in
+// every mode, each pushing its quantization error onto the cells not yet
+// visited. Serpentine walks odd rows right to left, which stops the error
+// from piling up along one edge and breaks the diagonal worms of raster order.
+void AsciiRenderer::diffuseRow(const RendererConfig& cfg, const ToneTable& tone, AsciiCell* cells, int cols, int row)
+{
+    bool reverse = cfg.dither == DitherMode::Serpentine && (row & 1);
+    int step = reverse ? -1 : 1;
+    int last = static_cast<int>(kRamp.size()) - 1;
+    float* here = diffusion_.current.data() + kDiffusionChannels;
+    float* below = diffusion_.next.data() + kDiffusionChannels;
+
+    for (int i = 0; i < cols; ++i) {
+        int x = reverse ? cols - 1 - i : i;
+        AsciiCell& cell = cells[x];
+        RGB source = unpack_rgb(cell.fg);
+        const float* carried = here + x * kDiffusionChannels;
 
-            buffer.append(cell.glyph);
+        float want[kDiffusionChannels];
+        want[0] = std::clamp(source.r + carried[0], 0.0f, 255.0f);
+        want[1] = std::clamp(source.g + carried[1], 0.0f, 255.0f);
+        want[2] = std::clamp(source.b + carried[2], 0.0f, 255.0f);
+        float luma = luminance(source.r, source.g, source.b);
+        size_t toneIndex = std::min(static_cast<size_t>(luma * ToneTable::kStepsPerLevel + 0.5f),
+                                    ToneTable::kSize - 1);
+        want[3] = std::clamp(tone.level[toneIndex] + carried[3], 0.0f, 1.0f);
+
+        int rampIndex = std::clamp(static_cast<int>(want[3] * last + 0.5f), 0, last);
+        cell.glyph = static_cast<unsigned char>(kRamp[rampIndex]);
+        float got[kDiffusionChannels] = {want[0], want[1], want[2], static_cast<float>(rampIndex) / last};
+        if (cfg.mode == RenderMode::ANSI256) {
+            uint8_t idx = xterm_index_fast(static_cast<uint8_t>(want[0] + 0.5f), static_cast<uint8_t>(want[1] + 0.5f),
+                                           static_cast<uint8_t>(want[2] + 0.5f));
+            const RGB& quantized = xterm_palette()[idx];
+            cell.fg = pack_rgb(quantized.r, quantized.g, quantized.b);
+            cell.paletteIndex = idx;
+            got[0] = quantized.r;
+            got[1] = quantized.g;
+            got[2] = quantized.b;
+        } else if (cfg.mode == RenderMode::Gray) {
+            uint8_t gray = static_cast<uint8_t>(luma);
+            cell.fg = pack_rgb(gray, gray, gray);
+        }
+
+        float* ahead = here + (x + step) * kDiffusionChannels;
+        float* belowBehind = below + (x - step) * kDiffusionChannels;
+        float* belowHere = below + x * kDiffusionChannels;
+        float* belowAhead = below + (x + step) * kDiffusionChannels;
+        for (size_t c = 0; c < kDiffusionChannels; ++c) {
+            float error = want[c] - got[c];
+            ahead[c] += error * (7.0f / 16.0f);
+            belowBehind[c] += error * (3.0f / 16.0f);
+            belowHere[c] += error * (5.0f / 16.0f);
+            belowAhead[c] += error * (1.0f / 16.0f);
         }
-        buffer.append("\x1b[0m\r\n");
     }
-    ascii.terminalString = std::move(buffer);
+
+    std::swap(diffusion_.current, diffusion_.next);
+    std::fill(diffusion_.next.begin(), diffusion_.next.end(), 0.0f);
+}
+
+void AsciiRenderer::diffuseBand(const RendererConfig& cfg, const ToneTable& tone, AsciiFrame& ascii, size_t band,
+                                int rowBegin, int rowEnd, BandScratch& scratch)
+{
+    // The pool hands out bands in ascending order, so the band before this
+    // one is already running and the wait always ends.
+    {
+        std::unique_lock<std::mutex> lock(diffusionMutex_);
+        diffusionTurn_.wait(lock, [&] { return diffusionBand_ == band; });
+    }
+    for (int y = rowBegin; y < rowEnd; ++y) {
+        AsciiCell* row = ascii.cells.data() + y * ascii.cols;
+        if (!cfg.halfBlock) {
+            diffuseRow(cfg, tone, row, ascii.cols, y);
+            continue;
+        }
+        diffuseRow(cfg, tone, row, ascii.cols, y * 2);
+        diffuseRow(cfg, tone, scratch.lowerCells.data() + (y - rowBegin) * ascii.cols, ascii.cols, y * 2 + 1);
+    }
+    {
+        std::lock_guard<std::mutex> lock(diffusionMutex_);
+        ++diffusionBand_;
+    }
+    diffusionTurn_.notify_all();
+
+    if (!cfg.halfBlock) return;
+    for (int y = rowBegin; y < rowEnd; ++y) {
+        combineHalfBlocks(ascii.cells.data() + y * ascii.cols,
+                          scratch.lowerCells.data() + (y - rowBegin) * ascii.cols, ascii.cols);
+    }
+}
+
+AsciiFrame AsciiRenderer::render(const VideoFrame& frame, const RenderOutputs& outputs)
+{
+    RendererConfig cfg;
+    std::shared_ptr<const ToneTable> tone;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cfg = config_;
+        tone = tone_;
+    }
+
+    AsciiFrame ascii;
+    ascii.cols = cfg.gridCols;
+    ascii.rows = cfg.gridRows;
+    ascii.halfBlock = cfg.halfBlock;
+    ascii.mode = cfg.mode;
+    ascii.pts = frame.pts;
+    ascii.serial = frame.serial;
+    ascii.sequence = ++sequence_;
+    ascii.cells.resize(ascii.cols * ascii.rows);
+
+    size_t threads = cfg.renderThreads > 0 ? static_cast<size_t>(cfg.renderThreads)
+                                           : std::max(1u, std::thread::hardware_concurrency());
+    if (!pool_ || pool_->size() != threads) {
+        pool_ = std::make_unique<WorkerPool>(threads);
+    }
+
+    // Colour state restarts on every row, so each band encodes its own slice
+    // and the concatenation matches a single pass byte for byte.
+    size_t bands = std::min(static_cast<size_t>(ascii.rows), threads * kBandsPerThread);
+    if (threads == 1) bands = std::min<size_t>(bands, 1);
+    bands_.resize(bands);
+    bool diffuse = is_error_diffusion(cfg.dither);
+    bool incremental = cfg.incremental && !diffuse;
+    reusePrevious_ = incremental && previousTone_ == tone && !previousSource_.data.empty()
+        && previousSource_.width == frame.width && previousSource_.height == frame.height
+        && previousSource_.format == frame.format && previousSource_.data.size() == frame.data.size()
+        && previousConfig_.mode == cfg.mode && previousConfig_.dither == cfg.dither
+        && previousConfig_.halfBlock == cfg.halfBlock && previousConfig_.gridCols == cfg.gridCols
+        && previousCells_.size() == ascii.cells.size();
+    if (reusePrevious_) ascii.dirty.resize(ascii.cells.size());
+    if (diffuse) {
+        size_t width = (static_cast<size_t>(ascii.cols) + 2) * kDiffusionChannels;
+        diffusion_.current.assign(width, 0.0f);
+        diffusion_.next.assign(width, 0.0f);
+        diffusionBand_ = 0;
+    }
+    pool_->run(bands, [&](size_t band) {
+        int rowBegin = static_cast<int>(band * ascii.rows / bands);
+        int rowEnd = static_cast<int>((band + 1) * ascii.rows / bands);
+        sampleRows(cfg, *tone, frame, ascii, rowBegin, rowEnd, bands_[band]);
+        if (diffuse) diffuseBand(cfg, *tone, ascii, band, rowBegin, rowEnd, bands_[band]);
+        EncodeBuffer& slice = bands_[band].text;
+        slice.clear();
+        if (!outputs.terminalString) return;
+        char* out = slice.reserveTail((rowEnd - rowBegin) * (max_encoded_cells(ascii.cols) + kEncodedRowEndBytes));
+        slice.commit(encode_rows(ascii, EncodeOptions{cfg.mode, cfg.halfBlock}, rowBegin, rowEnd, out));
+    });
+
+    if (incremental) {
+        previousSource_ = frame;
+        previousCells_.assign(ascii.cells.begin(), ascii.cells.end());
+        previousConfig_ = cfg;
+        previousTone_ = tone;
+    } else if (previousTone_) {
+        previousSource_ = VideoFrame();
+        previousCells_.clear();
+        previousTone_.reset();
+    }
+
+    if (!outputs.terminalString) return ascii;
+
+    static constexpr char kHome[] = "\x1b[H";
+    size_t total = sizeof(kHome) - 1;
+    for (const auto& band : bands_) total += band.text.size();
+    ascii.terminalString = textPool_.acquire(total);
+    char* text = ascii.terminalString.data();
+    std::memcpy(text, kHome, sizeof(kHome) - 1);
+    text += sizeof(kHome) - 1;
+    for (const auto& band : bands_) {
+        if (band.text.empty()) continue;
+        std::memcpy(text, band.text.data(), band.text.size());
+        text += band.text.size();
+    }
     return ascii;
 }
 
@@ -2,9 +2,16 @@
 
 #include "color_lut.hpp"
 #include "decoder.hpp"
+#include "encode_buffer.hpp"
+#include "frame_pool.hpp"
+#include "worker_pool.hpp"
 
+#include <array>
+#include <condition_variable>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 namespace asciiplay {
@@ -17,21 +24,45 @@ struct RendererConfig {
     int gridRows = 60;
     float gamma = 2.2f;
     float contrast = 1.0f;
+    // Row-band workers for render(); 0 picks the hardware concurrency.
+    int renderThreads = 1;
+    // Re-sample only cells whose source pixels changed since the previous
+    // frame. Ignored with error diffusion, where every cell depends on the
+    // ones rendered before it.
+    bool incremental = false;
 };
 
+// Plain value type so cell grids copy and stream as contiguous memory.
 struct AsciiCell {
-    std::string glyph = " ";
+    uint32_t glyph = ' '; // Unicode code point
     uint32_t fg = 0xFFFFFF;
     uint32_t bg = 0x000000;
+    uint8_t paletteIndex = 0; // xterm index of fg, set in ANSI256 mode
 };
 
+static_assert(std::is_trivially_copyable<AsciiCell>::value, "AsciiCell must stay trivially copyable");
+
 struct AsciiFrame {
     int cols = 0;
     int rows = 0;
     bool halfBlock = false;
+    RenderMode mode = RenderMode::Gray;
     double pts = 0.0;
+    uint64_t serial = 0; // VideoFrame::serial of the source frame
+    uint64_t sequence = 0; // counts render() calls, see dirty
     std::vector<AsciiCell> cells;
-    std::string terminalString;
+    // Filled by incremental renders: nonzero for cells that may differ from
+    // the frame rendered just before (sequence - 1). Empty means any cell may
+    // have changed.
+    std::vector<uint8_t> dirty;
+    FrameBuffer<char> terminalString; // leased from the renderer's text pool
+};
+
+// Products render() builds on top of the cell grid, which it always fills.
+// Sinks ask only for what they read: the exporter, cache writer and network
+// sink work from cells alone.
+struct RenderOutputs {
+    bool terminalString = true; // the full-frame ANSI stream
 };
 
 class AsciiRenderer {
@@ -39,7 +70,7 @@ public:
     AsciiRenderer();
 
     void configure(const RendererConfig& cfg);
-    AsciiFrame render(const VideoFrame& frame);
+    AsciiFrame render(const VideoFrame& frame, const RenderOutputs& outputs = RenderOutputs{});
     void cycleMode();
     void cycleDither();
     void adjustGamma(float delta);
@@ -47,13 +78,84 @@ public:
     RendererConfig config() const;
 
 private:
-    AsciiCell sampleCell(const uint8_t* rgb, int width, int height, int startX, int startY,
-                         int cellWidth, int cellHeight, int row, int col) const;
-    void buildRamp();
+    // Everything derived from gamma, contrast and the ramp, indexed by luma in
+    // quarter steps so fractional RGB averages keep most of their precision.
+    struct ToneTable {
+        static constexpr int kStepsPerLevel = 4;
+        static constexpr size_t kSize = 255 * kStepsPerLevel + 1;
+        std::array<float, kSize> level{}; // after gamma and contrast, 0..1
+        std::array<char, kSize> glyph{};
+    };
+
+    // Scratch owned by one render band, reused from frame to frame.
+    struct BandScratch {
+        EncodeBuffer text;
+        std::vector<uint16_t> columnSums;
+        std::vector<AsciiCell> lowerCells; // every row of the band when diffusing
+    };
+
+    // Error carried from one diffused row to the next, four floats per cell
+    // (r, g, b, tone level) with a padding cell on either side.
+    struct DiffusionState {
+        std::vector<float> current; // error arriving at the row being diffused
+        std::vector<float> next;    // error for the row below
+    };
+
+    AsciiCell sampleCell(const RendererConfig& cfg, const ToneTable& tone, const uint8_t* rgb,
+                         int width, int height, int startX, int startY, int cellWidth, int cellHeight,
+                         int row, int col) const;
+    AsciiCell sampleLumaCell(const RendererConfig& cfg, const ToneTable& tone, const uint8_t* luma,
+                             int width, int height, int startX, int startY, int cellWidth, int cellHeight,
+                             int row, int col) const;
+    AsciiCell sampleCellAt(const RendererConfig& cfg, const ToneTable& tone, const VideoFrame& frame,
+                           int startX, int startY, int cellWidth, int cellHeight, int row, int col) const;
+    AsciiCell shadeRgb(const RendererConfig& cfg, const ToneTable& tone, uint32_t sumR, uint32_t sumG,
+                       uint32_t sumB, uint32_t count, int row, int col) const;
+    AsciiCell shadeLuma(const RendererConfig& cfg, const ToneTable& tone, uint32_t sum, uint32_t count,
+                        int row, int col) const;
+    AsciiCell shadeCell(const RendererConfig& cfg, const ToneTable& tone, size_t toneIndex, uint8_t gray,
+                        uint8_t r, uint8_t g, uint8_t b, int row, int col) const;
+    void sampleCellRow(const RendererConfig& cfg, const ToneTable& tone, const VideoFrame& frame,
+                       int startY, int cellWidth, int cellHeight, int ditherRow,
+                       std::vector<uint16_t>& columnSums, AsciiCell* out) const;
+    void sampleRows(const RendererConfig& cfg, const ToneTable& tone, const VideoFrame& frame,
+                    AsciiFrame& ascii, int rowBegin, int rowEnd, BandScratch& scratch) const;
+    // Flags the cells of one row whose source lines [lineBegin, lineEnd)
+    // differ from previousSource_; returns how many were flagged.
+    int markDirtyCells(const VideoFrame& frame, int lineBegin, int lineEnd, int cellWidth, int cols,
+                       uint8_t* dirty) const;
+    // Starts from the previous frame's row and re-samples only flagged cells.
+    void resampleDirtyCells(const RendererConfig& cfg, const ToneTable& tone, const VideoFrame& frame,
+                            AsciiFrame& ascii, int y, int cellWidth, int cellHeight) const;
+    void diffuseRow(const RendererConfig& cfg, const ToneTable& tone, AsciiCell* cells, int cols, int row);
+    void diffuseBand(const RendererConfig& cfg, const ToneTable& tone, AsciiFrame& ascii, size_t band,
+                     int rowBegin, int rowEnd, BandScratch& scratch);
+    void rebuildTables();
 
     RendererConfig config_;
-    std::vector<char> ramp_;
+    // Replaced, never modified, so render() can keep using its snapshot.
+    std::shared_ptr<const ToneTable> tone_;
     mutable std::mutex mutex_;
+
+    // Only touched from render(), which runs on a single thread.
+    std::unique_ptr<WorkerPool> pool_;
+    std::vector<BandScratch> bands_;
+    FramePool<char> textPool_;
+    // Error diffusion runs band after band in order: each band samples in
+    // parallel, then waits for its turn at the error carried out of the one
+    // above. The state belongs to the band holding the turn.
+    DiffusionState diffusion_;
+    std::mutex diffusionMutex_;
+    std::condition_variable diffusionTurn_;
+    size_t diffusionBand_ = 0;
+    // Incremental rendering: the last source frame (its buffer lease is held
+    // until the next one) and what it rendered to, under which settings.
+    VideoFrame previousSource_;
+    std::vector<AsciiCell> previousCells_;
+    RendererConfig previousConfig_;
+    std::shared_ptr<const ToneTable> previousTone_;
+    bool reusePrevious_ = false; // for the frame being rendered
+    uint64_t sequence_ = 0;
 };
 
 } // namespace asciiplay
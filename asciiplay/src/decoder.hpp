@@ -7,13 +7,18 @@ extern "C" {
 #include <libswresample/swresample.h>
 }
 
-#include <condition_variable>
+#include "frame_pool.hpp"
+#include "metrics.hpp"
+#include "stage_queue.hpp"
+
+#include <atomic>
 #include <cstdint>
+#include <memory>
 #include <mutex>
 #include <optional>
-#include <queue>
 #include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
 namespace asciiplay {
@@ -21,17 +26,27 @@ namespace asciiplay {
 struct VideoFrame {
     int width = 0;
     int height = 0;
-    std::vector<uint8_t> data; // RGB24
+    AVPixelFormat format = AV_PIX_FMT_RGB24; // RGB24 or GRAY8
+    FrameBuffer<uint8_t> data;
     double pts = 0.0;
+    uint64_t serial = 0; // seek generation, see Decoder::serial()
 };
 
 struct AudioFrame {
-    std::vector<int16_t> samples; // interleaved stereo
+    FrameBuffer<int16_t> samples; // interleaved stereo
     int sampleRate = 48000;
     int channels = 2;
     double pts = 0.0;
+    uint64_t serial = 0;
+};
+
+struct PacketDeleter {
+    void operator()(AVPacket* packet) const { av_packet_free(&packet); }
 };
 
+// Compressed packet handed on without decoding (audio stream copy).
+using PacketPtr = std::unique_ptr<AVPacket, PacketDeleter>;
+
 struct DecoderStats {
     double videoFps = 0.0;
     double audioFps = 0.0;
@@ -40,8 +55,37 @@ struct DecoderStats {
 };
 
 struct DecoderOptions {
-    std::string url;
+    std::string url; // file, network URL, "pipe:0" or a capture device
+    // Demuxer to use instead of probing, e.g. "v4l2", "dshow" or "mpegts".
+    std::string inputFormat;
+    // Passed to the demuxer as is, e.g. {"rtsp_transport", "tcp"} or
+    // {"video_size", "640x480"}.
+    std::vector<std::pair<std::string, std::string>> inputOptions;
+    // How much avformat_find_stream_info may read before playback starts;
+    // negative keeps FFmpeg's defaults (5 MB, 5 s).
+    int64_t probeSize = -1;       // bytes
+    int64_t analyzeDuration = -1; // microseconds
+    // Live sources: no demuxer buffering (fflags nobuffer), low-delay
+    // decoding, and slice threads only, since frame threads hold back a
+    // frame per thread.
+    bool lowLatency = false;
+    // Seconds into the input to start from, and how much of it to play
+    // (0 = to the end). The decoder seeks instead of decoding its way there.
+    double start = 0.0;
+    double duration = 0.0;
     bool enableAudio = true;
+    // Queue the compressed audio packets instead of decoding them; read them
+    // with popAudioPacket().
+    bool audioPassthrough = false;
+    // Video decoder threads; 0 lets FFmpeg pick from the core count. The
+    // demuxer always runs on the decode thread.
+    int decodeThreads = 0;
+    // Hardware device type ("vaapi", "cuda", "d3d11va", "videotoolbox", ...)
+    // or "auto" for the first one that works. Empty decodes in software.
+    std::string hwDevice;
+    size_t videoQueueDepth = 8;
+    size_t audioQueueDepth = 32;
+    QueuePolicy videoQueuePolicy = QueuePolicy::Block;
 };
 
 class Decoder {
@@ -55,16 +99,57 @@ public:
 
     bool popVideoFrame(VideoFrame& frame);
     bool popAudioFrame(AudioFrame& frame);
+    bool popAudioPacket(PacketPtr& packet);
+    // Jumps to `seconds` (in frame pts terms) from the keyframe at or before
+    // it. Queued frames are discarded and serial() moves on; frames still in
+    // flight keep the old serial, so consumers drop any that do not match.
+    // Seeks after the input has ended are ignored.
+    void seek(double seconds);
+    uint64_t serial() const { return serial_.load(); }
+    // Requests RGB output at the given size instead of the native resolution.
+    // Zero in either dimension restores native output. Safe to call while decoding.
+    void setOutputSize(int width, int height);
+    // Switches output between RGB24 and a GRAY8 luma plane; safe to call while decoding.
+    void setOutputFormat(AVPixelFormat format);
+    // Lets the codec discard non-reference frames to catch up; safe to call while decoding.
+    void setSkipNonReference(bool skip) { skipNonRef_ = skip; }
+    bool skippingNonReference() const { return skipNonRef_; }
+    // Decoded frames lost because the hardware surface could not be read back.
+    uint64_t failedDownloads() const { return failedDownloads_.load(std::memory_order_relaxed); }
     bool isFinished() const { return finished_; }
     AVRational videoTimeBase() const { return videoTimeBase_; }
     AVRational audioTimeBase() const { return audioTimeBase_; }
     double videoFrameDuration() const { return videoFrameDuration_; }
+    // Container duration in seconds; 0 when the input does not report one.
+    double duration() const { return duration_; }
+    // Timestamp of the first sample in the container, in seconds.
+    double startTime() const { return startTime_; }
+    // Timestamp playback begins at: startTime() plus DecoderOptions::start.
+    double playbackStart() const { return startTime_ + options_.start; }
+    // Length of the range being played; 0 when unknown.
+    double playbackDuration() const;
+    // Parameters of the selected audio stream, or null without audio.
+    const AVCodecParameters* audioParameters() const
+    {
+        return audioStream_ >= 0 ? fmtCtx_->streams[audioStream_]->codecpar : nullptr;
+    }
+    int sourceWidth() const { return videoCtx_ ? videoCtx_->width : 0; }
+    int sourceHeight() const { return videoCtx_ ? videoCtx_->height : 0; }
     const DecoderStats& stats() const { return stats_; }
+    QueueStats videoQueueStats() const { return videoQueue_.stats(); }
+    QueueStats audioQueueStats() const { return audioQueue_.stats(); }
+    const LatencyHistogram& decodeTimes() const { return decodeTimes_; }
+    const LatencyHistogram& scaleTimes() const { return scaleTimes_; }
 
 private:
+    static AVPixelFormat negotiateFormat(AVCodecContext* ctx, const AVPixelFormat* formats);
+    bool setupHardware(const AVCodec* codec);
+    const AVFrame* downloadFrame(AVFrame* frame, AVFrame* staging);
     void decodeLoop();
-    void pushVideoFrame(const VideoFrame& frame);
-    void pushAudioFrame(const AudioFrame& frame);
+    // Repositions the demuxer and drops everything the codecs buffered.
+    void seekInput(double seconds);
+    void pushVideoFrame(VideoFrame&& frame);
+    void pushAudioFrame(AudioFrame&& frame);
 
     DecoderOptions options_;
     AVFormatContext* fmtCtx_ = nullptr;
@@ -72,23 +157,43 @@ private:
     AVCodecContext* audioCtx_ = nullptr;
     SwsContext* swsCtx_ = nullptr;
     SwrContext* swrCtx_ = nullptr;
+    AVBufferRef* hwDeviceCtx_ = nullptr;
+    AVPixelFormat hwPixFmt_ = AV_PIX_FMT_NONE;
     int videoStream_ = -1;
     int audioStream_ = -1;
     AVRational videoTimeBase_{};
     AVRational audioTimeBase_{};
     double videoFrameDuration_ = 0.0;
+    double duration_ = 0.0;
+    double startTime_ = 0.0;
+
+    // Seek requested by seek() and taken up by the decode thread.
+    std::mutex seekMutex_;
+    bool seekPending_ = false;
+    double seekTarget_ = 0.0;
+    uint64_t seekSerial_ = 0;
+    std::atomic<uint64_t> serial_{0};
+
+    std::mutex scaleMutex_;
+    int targetWidth_ = 0;
+    int targetHeight_ = 0;
+    AVPixelFormat targetFormat_ = AV_PIX_FMT_RGB24;
+
+    FramePool<uint8_t> videoPool_;
+    FramePool<int16_t> audioPool_;
 
     std::thread decodeThread_;
-    std::mutex videoMutex_;
-    std::mutex audioMutex_;
-    std::condition_variable videoCv_;
-    std::condition_variable audioCv_;
-    std::queue<VideoFrame> videoQueue_;
-    std::queue<AudioFrame> audioQueue_;
-    bool running_ = false;
-    bool finished_ = false;
+    StageQueue<VideoFrame> videoQueue_;
+    StageQueue<AudioFrame> audioQueue_;
+    StageQueue<PacketPtr> audioPackets_;
+    std::atomic<bool> running_{false};
+    std::atomic<bool> finished_{false};
+    std::atomic<bool> skipNonRef_{false};
+    std::atomic<uint64_t> failedDownloads_{0};
 
     DecoderStats stats_{};
+    LatencyHistogram decodeTimes_;
+    LatencyHistogram scaleTimes_;
 };
 
 } // namespace asciiplay
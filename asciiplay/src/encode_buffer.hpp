@@ -0,0 +1,44 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+
+namespace asciiplay {
+
+// Byte buffer that keeps its storage between frames and never initialises
+// it, so encoders can write straight into it.
+class EncodeBuffer {
+public:
+    // Returns a cursor at the end with room for at least `extra` bytes.
+    char* reserveTail(size_t extra)
+    {
+        if (size_ + extra > capacity_) {
+            size_t capacity = std::max(size_ + extra, capacity_ * 2);
+            std::unique_ptr<char[]> storage(new char[capacity]);
+            if (size_ > 0) std::memcpy(storage.get(), storage_.get(), size_);
+            storage_ = std::move(storage);
+            capacity_ = capacity;
+        }
+        return storage_.get() + size_;
+    }
+    void commit(char* end) { size_ = static_cast<size_t>(end - storage_.get()); }
+    void append(const char* data, size_t size)
+    {
+        char* tail = reserveTail(size);
+        if (size > 0) std::memcpy(tail, data, size);
+        size_ += size;
+    }
+    void clear() { size_ = 0; }
+    const char* data() const { return storage_.get(); }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+private:
+    std::unique_ptr<char[]> storage_;
+    size_t capacity_ = 0;
+    size_t size_ = 0;
+};
+
+} // namespace asciiplay
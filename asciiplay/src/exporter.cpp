@@ -3,14 +3,43 @@
 #include "color_lut.hpp"
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <thread>
 
 extern "C" {
+#include <libavutil/channel_layout.h>
 #include <libavutil/opt.h>
 }
 
 namespace asciiplay {
 
+namespace {
+constexpr int kFirstGlyph = 32;
+constexpr int kGlyphCount = 95;
+// A few bands per worker keeps the pool busy when rows cost unevenly.
+constexpr size_t kBandsPerThread = 4;
+// Pictures in flight beyond the queue: one being rasterized, one being encoded.
+constexpr size_t kSpareFrames = 2;
+// Encoded packets in flight between the encoders and the muxer.
+constexpr size_t kPacketPool = 32;
+constexpr int64_t kAudioBitRate = 160000;
+// AAC frame size, used if the encoder does not report one.
+constexpr int kDefaultAudioFrame = 1024;
+
+// BT.601 limited range, the same matrix swscale uses for RGB to YUV by default.
+void rgb_to_yuv(uint32_t rgb, uint8_t* yuv)
+{
+    int r = (rgb >> 16) & 0xFF;
+    int g = (rgb >> 8) & 0xFF;
+    int b = rgb & 0xFF;
+    yuv[0] = static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+    yuv[1] = static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+    yuv[2] = static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+}
+
 Exporter::Exporter() = default;
 
 Exporter::~Exporter()
@@ -27,24 +56,86 @@ bool Exporter::open(const ExportConfig& cfg, std::string& err)
         err = "Empty export filename";
         return false;
     }
-    return initializeEncoder(err);
+    buildAtlas();
+    size_t threads = config_.threads > 0 ? static_cast<size_t>(config_.threads)
+                                         : std::max(1u, std::thread::hardware_concurrency());
+    pool_ = std::make_unique<WorkerPool>(threads);
+    if (!initializeEncoder(err)) {
+        return false;
+    }
+    startStages();
+    return true;
+}
+
+void Exporter::buildAtlas()
+{
+    atlas_.assign(static_cast<size_t>(kGlyphCount) * glyphW_ * glyphH_, 0);
+    for (int g = 0; g < kGlyphCount; ++g) {
+        const auto& glyph = font8x16::basic_font[g];
+        uint8_t* mask = atlas_.data() + static_cast<size_t>(g) * glyphW_ * glyphH_;
+        // Nearest sampling of the 8x16 glyph, which doubles each 8x8 font row.
+        for (int y = 0; y < glyphH_; ++y) {
+            int srcY = y * font8x16::glyph_height / glyphH_;
+            uint8_t rowBits = glyph.rows[srcY / 2];
+            for (int x = 0; x < glyphW_; ++x) {
+                int srcX = x * font8x16::glyph_width / glyphW_;
+                mask[y * glyphW_ + x] = (rowBits >> srcX) & 0x1;
+            }
+        }
+    }
+    int width = config_.gridCols * glyphW_;
+    columnCell_.resize(width);
+    columnGlyphX_.resize(width);
+    for (int x = 0; x < width; ++x) {
+        columnCell_[x] = x / glyphW_;
+        columnGlyphX_[x] = x % glyphW_;
+    }
+
+    blank_ = CellShade{};
+    blank_.mask = atlas_.data(); // ' ' is all background
+    rgb_to_yuv(0, blank_.fgYuv);
+    rgb_to_yuv(0, blank_.bgYuv);
 }
 
 void Exporter::close()
 {
+    // Audio goes first: its tail has to reach the muxer before the video
+    // stage shuts the mux queue.
+    if (opened_ && audioDecCtx_ && !failed_) {
+        transcodeAudio(nullptr);
+    }
+    rasterQueue_.close();
+    if (rasterThread_.joinable()) rasterThread_.join();
+    if (encodeThread_.joinable()) encodeThread_.join();
+    if (muxThread_.joinable()) muxThread_.join();
+
     if (opened_) {
         av_write_trailer(fmtCtx_);
     }
+    for (AVFrame*& frame : frames_) av_frame_free(&frame);
+    for (AVPacket*& packet : packets_) av_packet_free(&packet);
+    frames_.clear();
+    packets_.clear();
     if (rgbFrame_) av_frame_free(&rgbFrame_);
-    if (yuvFrame_) av_frame_free(&yuvFrame_);
     if (codecCtx_) avcodec_free_context(&codecCtx_);
+    if (audioDecCtx_) avcodec_free_context(&audioDecCtx_);
+    if (audioEncCtx_) avcodec_free_context(&audioEncCtx_);
+    if (audioSwr_) swr_free(&audioSwr_);
+    if (audioFifo_) av_audio_fifo_free(audioFifo_);
+    audioFifo_ = nullptr;
+    av_frame_free(&audioFrame_);
+    av_frame_free(&audioConverted_);
+    av_frame_free(&audioChunk_);
+    audioStream_ = nullptr;
     if (fmtCtx_) {
         if (!(fmtCtx_->oformat->flags & AVFMT_NOFILE)) {
             avio_closep(&fmtCtx_->pb);
         }
         avformat_free_context(fmtCtx_);
+        fmtCtx_ = nullptr;
     }
     if (swsCtx_) sws_freeContext(swsCtx_);
+    swsCtx_ = nullptr;
     opened_ = false;
 }
 
@@ -80,9 +171,10 @@ bool Exporter::initializeEncoder(std::string& err)
     codecCtx_->pix_fmt = codec->pix_fmts ? codec->pix_fmts[0] : AV_PIX_FMT_YUV420P;
     codecCtx_->gop_size = 12;
     codecCtx_->max_b_frames = 2;
+    codecCtx_->thread_count = std::max(0, config_.encoderThreads);
 
     if (codec->id == AV_CODEC_ID_H264 && codecCtx_->priv_data) {
-        av_opt_set(codecCtx_->priv_data, "preset", "medium", 0);
+        av_opt_set(codecCtx_->priv_data, "preset", config_.preset.c_str(), 0);
         av_opt_set(codecCtx_->priv_data, "crf", std::to_string(config_.crf).c_str(), 0);
     }
 
@@ -97,6 +189,10 @@ bool Exporter::initializeEncoder(std::string& err)
 
     avcodec_parameters_from_context(stream_->codecpar, codecCtx_);
 
+    if (config_.audioParams) {
+        initializeAudio();
+    }
+
     if (!(fmtCtx_->oformat->flags & AVFMT_NOFILE)) {
         if (avio_open(&fmtCtx_->pb, config_.outputFile.c_str(), AVIO_FLAG_WRITE) < 0) {
             err = "Failed to open output file";
@@ -109,18 +205,37 @@ bool Exporter::initializeEncoder(std::string& err)
         return false;
     }
 
+    size_t frameCount = std::max<size_t>(1, config_.queueDepth) + kSpareFrames;
+    for (size_t i = 0; i < frameCount; ++i) {
+        AVFrame* frame = av_frame_alloc();
+        frame->format = codecCtx_->pix_fmt;
+        frame->width = codecCtx_->width;
+        frame->height = codecCtx_->height;
+        if (av_frame_get_buffer(frame, 32) < 0) {
+            av_frame_free(&frame);
+            err = "Failed to allocate frame";
+            return false;
+        }
+        frames_.push_back(frame);
+    }
+    for (size_t i = 0; i < kPacketPool; ++i) {
+        packets_.push_back(av_packet_alloc());
+    }
+
+    // Most encoders take YUV420P, which the rasterizer writes directly;
+    // anything else goes through RGB24 and swscale.
+    directYuv_ = codecCtx_->pix_fmt == AV_PIX_FMT_YUV420P;
+    if (directYuv_) {
+        opened_ = true;
+        return true;
+    }
+
     rgbFrame_ = av_frame_alloc();
     rgbFrame_->format = AV_PIX_FMT_RGB24;
     rgbFrame_->width = codecCtx_->width;
     rgbFrame_->height = codecCtx_->height;
     av_frame_get_buffer(rgbFrame_, 32);
 
-    yuvFrame_ = av_frame_alloc();
-    yuvFrame_->format = codecCtx_->pix_fmt;
-    yuvFrame_->width = codecCtx_->width;
-    yuvFrame_->height = codecCtx_->height;
-    av_frame_get_buffer(yuvFrame_, 32);
-
     swsCtx_ = sws_getContext(codecCtx_->width, codecCtx_->height, AV_PIX_FMT_RGB24,
                              codecCtx_->width, codecCtx_->height, codecCtx_->pix_fmt,
                              SWS_BICUBIC, nullptr, nullptr, nullptr);
@@ -134,83 +249,417 @@ bool Exporter::initializeEncoder(std::string& err)
     return true;
 }
 
+// Problems with the audio track are not fatal; the export carries on
+// without it.
+void Exporter::initializeAudio()
+{
+    const AVCodecParameters* source = config_.audioParams;
+    audioStartPts_ = av_rescale_q(static_cast<int64_t>(config_.startTime * AV_TIME_BASE),
+                                  AV_TIME_BASE_Q, config_.audioTimeBase);
+
+    if (avformat_query_codec(fmtCtx_->oformat, source->codec_id, FF_COMPLIANCE_NORMAL) == 1) {
+        audioStream_ = avformat_new_stream(fmtCtx_, nullptr);
+        if (!audioStream_ || avcodec_parameters_copy(audioStream_->codecpar, source) < 0) {
+            std::cerr << "Warning: failed to add audio stream, exporting video only" << std::endl;
+            audioStream_ = nullptr;
+            return;
+        }
+        // The source container's tag may mean something else here.
+        audioStream_->codecpar->codec_tag = 0;
+        audioStream_->time_base = config_.audioTimeBase;
+        audioPacketTimeBase_ = config_.audioTimeBase;
+        return;
+    }
+
+    if (!initializeAudioEncoder()) {
+        std::cerr << "Warning: cannot re-encode audio for this container, exporting video only" << std::endl;
+        if (audioDecCtx_) avcodec_free_context(&audioDecCtx_);
+        if (audioEncCtx_) avcodec_free_context(&audioEncCtx_);
+        if (audioSwr_) swr_free(&audioSwr_);
+        audioStream_ = nullptr;
+    }
+}
+
+bool Exporter::initializeAudioEncoder()
+{
+    const AVCodecParameters* source = config_.audioParams;
+    AVCodec* decoder = avcodec_find_decoder(source->codec_id);
+    AVCodec* encoder = avcodec_find_encoder(AV_CODEC_ID_AAC);
+    if (!decoder || !encoder) return false;
+
+    audioDecCtx_ = avcodec_alloc_context3(decoder);
+    avcodec_parameters_to_context(audioDecCtx_, source);
+    audioDecCtx_->pkt_timebase = config_.audioTimeBase;
+    if (avcodec_open2(audioDecCtx_, decoder, nullptr) < 0) return false;
+
+    audioEncCtx_ = avcodec_alloc_context3(encoder);
+    audioEncCtx_->codec_type = AVMEDIA_TYPE_AUDIO;
+    audioEncCtx_->sample_rate = audioDecCtx_->sample_rate;
+    audioEncCtx_->channels = 2;
+    audioEncCtx_->channel_layout = AV_CH_LAYOUT_STEREO;
+    audioEncCtx_->sample_fmt = encoder->sample_fmts ? encoder->sample_fmts[0] : AV_SAMPLE_FMT_FLTP;
+    audioEncCtx_->bit_rate = kAudioBitRate;
+    audioEncCtx_->time_base = AVRational{1, audioEncCtx_->sample_rate};
+    if (fmtCtx_->oformat->flags & AVFMT_GLOBALHEADER) {
+        audioEncCtx_->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    if (avcodec_open2(audioEncCtx_, encoder, nullptr) < 0) return false;
+
+    uint64_t layout = audioDecCtx_->channel_layout
+        ? audioDecCtx_->channel_layout
+        : static_cast<uint64_t>(av_get_default_channel_layout(audioDecCtx_->channels));
+    audioSwr_ = swr_alloc_set_opts(nullptr,
+                                   AV_CH_LAYOUT_STEREO, audioEncCtx_->sample_fmt, audioEncCtx_->sample_rate,
+                                   layout, audioDecCtx_->sample_fmt, audioDecCtx_->sample_rate,
+                                   0, nullptr);
+    if (!audioSwr_ || swr_init(audioSwr_) < 0) return false;
+
+    int frameSize = audioEncCtx_->frame_size > 0 ? audioEncCtx_->frame_size : kDefaultAudioFrame;
+    audioFifo_ = av_audio_fifo_alloc(audioEncCtx_->sample_fmt, 2, frameSize * 2);
+    audioFrame_ = av_frame_alloc();
+    audioConverted_ = av_frame_alloc();
+    audioChunk_ = av_frame_alloc();
+
+    audioStream_ = avformat_new_stream(fmtCtx_, nullptr);
+    if (!audioStream_) return false;
+    avcodec_parameters_from_context(audioStream_->codecpar, audioEncCtx_);
+    audioStream_->time_base = audioEncCtx_->time_base;
+    audioPacketTimeBase_ = audioEncCtx_->time_base;
+    return true;
+}
+
+void Exporter::startStages()
+{
+    rasterQueue_.configure(std::max<size_t>(1, config_.queueDepth), QueuePolicy::Block);
+    encodeQueue_.configure(std::max<size_t>(1, config_.queueDepth), QueuePolicy::Block);
+    freeFrames_.configure(frames_.size(), QueuePolicy::Block);
+    freePackets_.configure(packets_.size(), QueuePolicy::Block);
+    muxQueue_.configure(packets_.size(), QueuePolicy::Block);
+    for (AVFrame* frame : frames_) freeFrames_.push(frame);
+    for (AVPacket* packet : packets_) freePackets_.push(packet);
+
+    rasterThread_ = std::thread(&Exporter::rasterLoop, this);
+    encodeThread_ = std::thread(&Exporter::encodeLoop, this);
+    muxThread_ = std::thread(&Exporter::muxLoop, this);
+}
+
 bool Exporter::writeFrame(const AsciiFrame& frame, std::string& err)
+{
+    return writeFrame(AsciiFrame(frame), err);
+}
+
+bool Exporter::writeFrame(AsciiFrame&& frame, std::string& err)
 {
     if (!opened_) {
         err = "Exporter not opened";
         return false;
     }
+    if (!failed_) {
+        // Only the cells are rasterized; hand any text lease straight back.
+        frame.terminalString = {};
+        if (rasterQueue_.push(std::move(frame))) return true;
+    }
+    std::lock_guard<std::mutex> lock(errorMutex_);
+    err = error_.empty() ? "Exporter closed" : error_;
+    return false;
+}
 
-    std::vector<uint32_t> buffer(rgbFrame_->width * rgbFrame_->height, 0);
-    blitAscii(frame, buffer);
+bool Exporter::writeAudioPacket(AVPacket* packet, std::string& err)
+{
+    if (!opened_ || !audioStream_) return true;
+    if (!failed_) {
+        if (audioDecCtx_) {
+            if (transcodeAudio(packet)) return true;
+        } else {
+            AVPacket* copy = nullptr;
+            if (freePackets_.pop(copy)) {
+                av_packet_move_ref(copy, packet);
+                if (copy->pts != AV_NOPTS_VALUE) copy->pts -= audioStartPts_;
+                if (copy->dts != AV_NOPTS_VALUE) copy->dts -= audioStartPts_;
+                copy->stream_index = audioStream_->index;
+                if (muxQueue_.push(copy)) return true;
+            }
+        }
+    }
+    std::lock_guard<std::mutex> lock(errorMutex_);
+    err = error_.empty() ? "Exporter closed" : error_;
+    return false;
+}
 
-    for (int y = 0; y < rgbFrame_->height; ++y) {
-        uint8_t* dst = rgbFrame_->data[0] + y * rgbFrame_->linesize[0];
-        for (int x = 0; x < rgbFrame_->width; ++x) {
-            uint32_t pixel = buffer[y * rgbFrame_->width + x];
-            dst[x * 3 + 0] = (pixel >> 16) & 0xFF;
-            dst[x * 3 + 1] = (pixel >> 8) & 0xFF;
-            dst[x * 3 + 2] = pixel & 0xFF;
+bool Exporter::transcodeAudio(const AVPacket* packet)
+{
+    // A corrupt packet only costs its own samples.
+    if (avcodec_send_packet(audioDecCtx_, packet) < 0 && packet) {
+        return true;
+    }
+    while (avcodec_receive_frame(audioDecCtx_, audioFrame_) == 0) {
+        if (audioNextPts_ == AV_NOPTS_VALUE) {
+            int64_t ts = audioFrame_->best_effort_timestamp;
+            audioNextPts_ = ts == AV_NOPTS_VALUE
+                ? 0
+                : av_rescale_q(ts - audioStartPts_, config_.audioTimeBase, audioEncCtx_->time_base);
+        }
+        av_frame_unref(audioConverted_);
+        audioConverted_->format = audioEncCtx_->sample_fmt;
+        audioConverted_->channel_layout = audioEncCtx_->channel_layout;
+        audioConverted_->sample_rate = audioEncCtx_->sample_rate;
+        int ret = swr_convert_frame(audioSwr_, audioConverted_, audioFrame_);
+        av_frame_unref(audioFrame_);
+        if (ret < 0) continue;
+        av_audio_fifo_write(audioFifo_, reinterpret_cast<void**>(audioConverted_->data),
+                            audioConverted_->nb_samples);
+    }
+    if (!packet) {
+        // Whatever the resampler still buffers.
+        av_frame_unref(audioConverted_);
+        audioConverted_->format = audioEncCtx_->sample_fmt;
+        audioConverted_->channel_layout = audioEncCtx_->channel_layout;
+        audioConverted_->sample_rate = audioEncCtx_->sample_rate;
+        if (swr_convert_frame(audioSwr_, audioConverted_, nullptr) == 0 && audioConverted_->nb_samples > 0) {
+            av_audio_fifo_write(audioFifo_, reinterpret_cast<void**>(audioConverted_->data),
+                                audioConverted_->nb_samples);
         }
     }
+    return encodeAudioChunks(!packet);
+}
 
-    sws_scale(swsCtx_, rgbFrame_->data, rgbFrame_->linesize, 0, rgbFrame_->height,
-              yuvFrame_->data, yuvFrame_->linesize);
+bool Exporter::encodeAudioChunks(bool flush)
+{
+    int frameSize = audioEncCtx_->frame_size > 0 ? audioEncCtx_->frame_size : kDefaultAudioFrame;
+    if (audioNextPts_ == AV_NOPTS_VALUE) audioNextPts_ = 0;
+    while (av_audio_fifo_size(audioFifo_) >= frameSize || (flush && av_audio_fifo_size(audioFifo_) > 0)) {
+        int samples = std::min(frameSize, av_audio_fifo_size(audioFifo_));
+        av_frame_unref(audioChunk_);
+        audioChunk_->nb_samples = samples;
+        audioChunk_->format = audioEncCtx_->sample_fmt;
+        audioChunk_->channel_layout = audioEncCtx_->channel_layout;
+        audioChunk_->sample_rate = audioEncCtx_->sample_rate;
+        if (av_frame_get_buffer(audioChunk_, 0) < 0) {
+            fail("Failed to allocate audio frame");
+            return false;
+        }
+        av_audio_fifo_read(audioFifo_, reinterpret_cast<void**>(audioChunk_->data), samples);
+        audioChunk_->pts = audioNextPts_;
+        audioNextPts_ += samples;
+        if (avcodec_send_frame(audioEncCtx_, audioChunk_) < 0) {
+            fail("Failed to send audio frame");
+            return false;
+        }
+        if (!drainPackets(audioEncCtx_, audioStream_->index)) return false;
+    }
+    if (flush && avcodec_send_frame(audioEncCtx_, nullptr) == 0) {
+        return drainPackets(audioEncCtx_, audioStream_->index);
+    }
+    return true;
+}
+
+void Exporter::fail(const std::string& message)
+{
+    {
+        std::lock_guard<std::mutex> lock(errorMutex_);
+        if (error_.empty()) error_ = message;
+    }
+    failed_ = true;
+    rasterQueue_.close();
+    freeFrames_.close();
+    encodeQueue_.close();
+    freePackets_.close();
+    muxQueue_.close();
+}
 
-    yuvFrame_->pts = frameIndex_++;
+void Exporter::rasterLoop()
+{
+    AsciiFrame frame;
+    while (rasterQueue_.pop(frame)) {
+        // Output timestamps follow the source clock so the audio track stays
+        // in sync; frames that land in an already used slot are dropped,
+        // unless the source has no usable timestamps at all.
+        int64_t pts = std::llround((frame.pts - config_.startTime) * config_.fps);
+        if (pts <= lastVideoPts_) {
+            if (frame.pts > lastSourcePts_) continue;
+            pts = lastVideoPts_ + 1;
+        }
+        lastVideoPts_ = pts;
+        lastSourcePts_ = frame.pts;
 
-    if (avcodec_send_frame(codecCtx_, yuvFrame_) < 0) {
-        err = "Failed to send frame";
-        return false;
+        AVFrame* picture = nullptr;
+        if (!freeFrames_.pop(picture)) break;
+        // The encoder may still hold a reference to this picture's buffers.
+        if (av_frame_make_writable(picture) < 0) {
+            fail("Failed to make frame writable");
+            break;
+        }
+        auto rasterStart = std::chrono::steady_clock::now();
+        rasterFrame(frame, picture);
+        rasterTimes_.record(std::chrono::steady_clock::now() - rasterStart);
+        picture->pts = pts;
+        if (!encodeQueue_.push(picture)) break;
     }
+    encodeQueue_.close();
+}
 
-    AVPacket* pkt = av_packet_alloc();
+void Exporter::encodeLoop()
+{
+    AVFrame* picture = nullptr;
+    while (encodeQueue_.pop(picture)) {
+        auto encodeStart = std::chrono::steady_clock::now();
+        int ret = avcodec_send_frame(codecCtx_, picture);
+        freeFrames_.push(picture);
+        if (ret < 0) {
+            fail("Failed to send frame");
+            break;
+        }
+        bool drained = drainPackets(codecCtx_, stream_->index);
+        encodeTimes_.record(std::chrono::steady_clock::now() - encodeStart);
+        if (!drained) break;
+    }
+    // Flush the pictures the encoder is still holding for lookahead.
+    if (!failed_ && avcodec_send_frame(codecCtx_, nullptr) == 0) {
+        drainPackets(codecCtx_, stream_->index);
+    }
+    muxQueue_.close();
+}
+
+bool Exporter::drainPackets(AVCodecContext* ctx, int streamIndex)
+{
     while (true) {
-        int ret = avcodec_receive_packet(codecCtx_, pkt);
+        AVPacket* packet = nullptr;
+        if (!freePackets_.pop(packet)) return false;
+        int ret = avcodec_receive_packet(ctx, packet);
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-            av_packet_free(&pkt);
-            break;
+            freePackets_.push(packet);
+            return true;
         }
         if (ret < 0) {
-            err = "Failed to receive packet";
-            av_packet_free(&pkt);
+            freePackets_.push(packet);
+            fail("Failed to receive packet");
             return false;
         }
-        pkt->stream_index = stream_->index;
-        pkt->pts = av_rescale_q(pkt->pts, codecCtx_->time_base, stream_->time_base);
-        pkt->dts = av_rescale_q(pkt->dts, codecCtx_->time_base, stream_->time_base);
-        pkt->duration = av_rescale_q(pkt->duration, codecCtx_->time_base, stream_->time_base);
-        if (av_interleaved_write_frame(fmtCtx_, pkt) < 0) {
-            err = "Failed to write packet";
-            av_packet_free(&pkt);
-            return false;
+        packet->stream_index = streamIndex;
+        if (!muxQueue_.push(packet)) return false;
+    }
+}
+
+void Exporter::muxLoop()
+{
+    AVPacket* packet = nullptr;
+    while (muxQueue_.pop(packet)) {
+        if (packet->stream_index == stream_->index) {
+            av_packet_rescale_ts(packet, codecCtx_->time_base, stream_->time_base);
+        } else {
+            av_packet_rescale_ts(packet, audioPacketTimeBase_, audioStream_->time_base);
+        }
+        bytesWritten_.fetch_add(static_cast<uint64_t>(packet->size), std::memory_order_relaxed);
+        int ret = av_interleaved_write_frame(fmtCtx_, packet);
+        av_packet_unref(packet);
+        freePackets_.push(packet);
+        if (ret < 0) {
+            fail("Failed to write packet");
+            break;
         }
-        av_packet_unref(pkt);
     }
-    return true;
 }
 
-void Exporter::blitAscii(const AsciiFrame& frame, std::vector<uint32_t>& buffer)
+void Exporter::rasterFrame(const AsciiFrame& frame, AVFrame* dst)
 {
-    int stride = rgbFrame_->width;
-    std::vector<uint32_t> glyphBuffer(font8x16::glyph_width * font8x16::glyph_height);
-    for (int y = 0; y < frame.rows; ++y) {
-        for (int x = 0; x < frame.cols; ++x) {
+    shadeCells(frame);
+    int units = directYuv_ ? (dst->height + 1) / 2 : rgbFrame_->height;
+    size_t bands = std::min(static_cast<size_t>(units), pool_->size() * kBandsPerThread);
+    pool_->run(bands, [&](size_t band) {
+        int begin = static_cast<int>(band * units / bands);
+        int end = static_cast<int>((band + 1) * units / bands);
+        if (directYuv_) {
+            rasterYuvRows(dst, begin, end);
+        } else {
+            rasterRgbRows(begin, end);
+        }
+    });
+
+    if (!directYuv_) {
+        sws_scale(swsCtx_, rgbFrame_->data, rgbFrame_->linesize, 0, rgbFrame_->height,
+                  dst->data, dst->linesize);
+    }
+}
+
+void Exporter::shadeCells(const AsciiFrame& frame)
+{
+    shades_.resize(static_cast<size_t>(config_.gridCols) * config_.gridRows);
+    for (int y = 0; y < config_.gridRows; ++y) {
+        for (int x = 0; x < config_.gridCols; ++x) {
+            CellShade& shade = shades_[static_cast<size_t>(y) * config_.gridCols + x];
+            // The frame may be smaller than the export grid; the rest stays black.
+            if (x >= frame.cols || y >= frame.rows) {
+                shade = blank_;
+                continue;
+            }
             const AsciiCell& cell = frame.cells[y * frame.cols + x];
-            char glyph = cell.glyph.empty() ? ' ' : cell.glyph[0];
-            if (glyph < 32 || glyph > 126) glyph = '#';
-            uint32_t fg = cell.fg;
-            uint32_t bg = cell.bg;
-            font8x16::blit_glyph(glyphBuffer.data(), font8x16::glyph_width, glyph, fg, bg);
-            int baseX = x * glyphW_;
-            int baseY = y * glyphH_;
-            for (int yy = 0; yy < glyphH_; ++yy) {
-                int srcY = yy * font8x16::glyph_height / glyphH_;
-                for (int xx = 0; xx < glyphW_; ++xx) {
-                    int srcX = xx * font8x16::glyph_width / glyphW_;
-                    buffer[(baseY + yy) * stride + (baseX + xx)] = glyphBuffer[srcY * font8x16::glyph_width + srcX];
+            uint32_t glyph = (cell.glyph >= 32 && cell.glyph <= 126) ? cell.glyph : '#';
+            shade.mask = atlas_.data() + static_cast<size_t>(glyph - kFirstGlyph) * glyphW_ * glyphH_;
+            shade.fg = cell.fg;
+            shade.bg = cell.bg;
+            if (directYuv_) {
+                rgb_to_yuv(cell.fg, shade.fgYuv);
+                rgb_to_yuv(cell.bg, shade.bgYuv);
+            }
+        }
+    }
+}
+
+const Exporter::CellShade& Exporter::shadeAt(int x, int y) const
+{
+    return shades_[static_cast<size_t>(y / glyphH_) * config_.gridCols + columnCell_[x]];
+}
+
+bool Exporter::coveredAt(const CellShade& shade, int x, int y) const
+{
+    return shade.mask[(y % glyphH_) * glyphW_ + columnGlyphX_[x]] != 0;
+}
+
+void Exporter::rasterYuvRows(AVFrame* dst, int pairBegin, int pairEnd)
+{
+    int width = dst->width;
+    int height = dst->height;
+    for (int pair = pairBegin; pair < pairEnd; ++pair) {
+        int rows = std::min(2, height - pair * 2);
+        uint8_t* lumaRows[2] = {
+            dst->data[0] + static_cast<size_t>(pair * 2) * dst->linesize[0],
+            dst->data[0] + static_cast<size_t>(pair * 2 + rows - 1) * dst->linesize[0],
+        };
+        uint8_t* uRow = dst->data[1] + static_cast<size_t>(pair) * dst->linesize[1];
+        uint8_t* vRow = dst->data[2] + static_cast<size_t>(pair) * dst->linesize[2];
+
+        for (int cx = 0; cx < (width + 1) / 2; ++cx) {
+            int sumU = 0;
+            int sumV = 0;
+            int count = 0;
+            for (int r = 0; r < rows; ++r) {
+                int y = pair * 2 + r;
+                for (int x = cx * 2; x < std::min(cx * 2 + 2, width); ++x) {
+                    const CellShade& shade = shadeAt(x, y);
+                    const uint8_t* yuv = coveredAt(shade, x, y) ? shade.fgYuv : shade.bgYuv;
+                    lumaRows[r][x] = yuv[0];
+                    sumU += yuv[1];
+                    sumV += yuv[2];
+                    ++count;
                 }
             }
+            uRow[cx] = static_cast<uint8_t>((sumU + count / 2) / count);
+            vRow[cx] = static_cast<uint8_t>((sumV + count / 2) / count);
+        }
+    }
+}
+
+void Exporter::rasterRgbRows(int rowBegin, int rowEnd)
+{
+    int width = rgbFrame_->width;
+    for (int y = rowBegin; y < rowEnd; ++y) {
+        uint8_t* dst = rgbFrame_->data[0] + static_cast<size_t>(y) * rgbFrame_->linesize[0];
+        for (int x = 0; x < width; ++x) {
+            const CellShade& shade = shadeAt(x, y);
+            uint32_t pixel = coveredAt(shade, x, y) ? shade.fg : shade.bg;
+            dst[x * 3 + 0] = (pixel >> 16) & 0xFF;
+            dst[x * 3 + 1] = (pixel >> 8) & 0xFF;
+            dst[x * 3 + 2] = pixel & 0xFF;
         }
     }
 }
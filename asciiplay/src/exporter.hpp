@@ -2,13 +2,22 @@
 
 #include "ascii_renderer.hpp"
 #include "decoder.hpp"
+#include "metrics.hpp"
+#include "stage_queue.hpp"
+#include "worker_pool.hpp"
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
+#include <libavutil/audio_fifo.h>
+#include <libswresample/swresample.h>
 #include <libswscale/swscale.h>
 }
 
@@ -22,6 +31,20 @@ struct ExportConfig {
     int fontH = 16;
     int fps = 30;
     int crf = 18;
+    // Raster bands run on this many threads; 0 picks the hardware concurrency.
+    int threads = 0;
+    // Codec threads; 0 lets the encoder decide.
+    int encoderThreads = 0;
+    std::string preset = "medium"; // x264 preset
+    // Frames buffered between the raster, encode and mux stages.
+    size_t queueDepth = 4;
+    // Source audio to carry into the file; null exports video only. Packets
+    // are copied as-is unless the container cannot hold the codec, in which
+    // case they are re-encoded to AAC.
+    const AVCodecParameters* audioParams = nullptr;
+    AVRational audioTimeBase{1, 1};
+    // Source timestamp, in seconds, that lands at zero in the output.
+    double startTime = 0.0;
 };
 
 class Exporter {
@@ -30,24 +53,113 @@ public:
     ~Exporter();
 
     bool open(const ExportConfig& cfg, std::string& err);
+    // Flushes the encoder and finishes the file.
     void close();
+    // Queues the frame for the raster, encode and mux threads. Blocks only
+    // while the pipeline is full; errors from the stages surface here.
     bool writeFrame(const AsciiFrame& frame, std::string& err);
+    // Same, taking over the cells instead of copying them.
+    bool writeFrame(AsciiFrame&& frame, std::string& err);
+    // Adds a source audio packet (in ExportConfig::audioTimeBase) to the
+    // file. Call from one thread only; a no-op without an audio track.
+    bool writeAudioPacket(AVPacket* packet, std::string& err);
+
+    const LatencyHistogram& rasterTimes() const { return rasterTimes_; }
+    const LatencyHistogram& encodeTimes() const { return encodeTimes_; }
+    QueueStats rasterQueueStats() const { return rasterQueue_.stats(); }
+    QueueStats encodeQueueStats() const { return encodeQueue_.stats(); }
+    QueueStats muxQueueStats() const { return muxQueue_.stats(); }
+    // Packet payload handed to the muxer so far.
+    uint64_t bytesWritten() const { return bytesWritten_.load(std::memory_order_relaxed); }
 
 private:
+    // Per-cell colours resolved once per frame, before the bands run.
+    struct CellShade {
+        const uint8_t* mask = nullptr; // atlas entry, glyphW_ x glyphH_
+        uint32_t fg = 0;
+        uint32_t bg = 0;
+        uint8_t fgYuv[3] = {};
+        uint8_t bgYuv[3] = {};
+    };
+
     bool initializeEncoder(std::string& err);
-    void blitAscii(const AsciiFrame& frame, std::vector<uint32_t>& buffer);
+    void initializeAudio();
+    bool initializeAudioEncoder();
+    void startStages();
+    void rasterLoop();
+    void encodeLoop();
+    void muxLoop();
+    bool drainPackets(AVCodecContext* ctx, int streamIndex);
+    // Null flushes the decoder, resampler and encoder.
+    bool transcodeAudio(const AVPacket* packet);
+    bool encodeAudioChunks(bool flush);
+    void fail(const std::string& message);
+    void buildAtlas();
+    void rasterFrame(const AsciiFrame& frame, AVFrame* dst);
+    void shadeCells(const AsciiFrame& frame);
+    // Pixel rows come in pairs so each band owns whole 2x2 chroma blocks.
+    void rasterYuvRows(AVFrame* dst, int pairBegin, int pairEnd);
+    void rasterRgbRows(int rowBegin, int rowEnd);
+    const CellShade& shadeAt(int x, int y) const;
+    bool coveredAt(const CellShade& shade, int x, int y) const;
 
     ExportConfig config_;
     AVFormatContext* fmtCtx_ = nullptr;
     AVCodecContext* codecCtx_ = nullptr;
     AVStream* stream_ = nullptr;
     SwsContext* swsCtx_ = nullptr;
-    AVFrame* rgbFrame_ = nullptr;
-    AVFrame* yuvFrame_ = nullptr;
-    int frameIndex_ = 0;
+    AVFrame* rgbFrame_ = nullptr; // raster thread only
+    int64_t lastVideoPts_ = -1;
+    double lastSourcePts_ = 0.0;
     bool opened_ = false;
     int glyphW_ = 8;
     int glyphH_ = 16;
+
+    // Coverage masks (0 = bg, 1 = fg) of every printable ASCII glyph at the
+    // output glyph size, built once at open().
+    std::vector<uint8_t> atlas_;
+    std::vector<CellShade> shades_;
+    // Output column to grid column and to x inside the glyph.
+    std::vector<int> columnCell_;
+    std::vector<int> columnGlyphX_;
+    CellShade blank_;
+    bool directYuv_ = false;
+    std::unique_ptr<WorkerPool> pool_;
+
+    // Frames and packets are allocated once at open() and cycle through
+    // the free lists; the queues carry the stages' work between threads.
+    std::vector<AVFrame*> frames_;
+    std::vector<AVPacket*> packets_;
+    StageQueue<AsciiFrame> rasterQueue_;
+    StageQueue<AVFrame*> freeFrames_;
+    StageQueue<AVFrame*> encodeQueue_;
+    StageQueue<AVPacket*> freePackets_;
+    StageQueue<AVPacket*> muxQueue_;
+    std::thread rasterThread_;
+    std::thread encodeThread_;
+    std::thread muxThread_;
+
+    // Audio track. The transcode state is only used when the container
+    // rejects the source codec, and only from writeAudioPacket() and close().
+    AVStream* audioStream_ = nullptr;
+    AVRational audioPacketTimeBase_{1, 1};
+    int64_t audioStartPts_ = 0;
+    AVCodecContext* audioDecCtx_ = nullptr;
+    AVCodecContext* audioEncCtx_ = nullptr;
+    SwrContext* audioSwr_ = nullptr;
+    AVAudioFifo* audioFifo_ = nullptr;
+    AVFrame* audioFrame_ = nullptr;
+    AVFrame* audioConverted_ = nullptr;
+    AVFrame* audioChunk_ = nullptr;
+    int64_t audioNextPts_ = AV_NOPTS_VALUE;
+
+    LatencyHistogram rasterTimes_;
+    LatencyHistogram encodeTimes_;
+    std::atomic<uint64_t> bytesWritten_{0};
+
+    std::mutex errorMutex_;
+    std::string error_;
+    std::atomic<bool> failed_{false};
 };
 
 } // namespace asciiplay
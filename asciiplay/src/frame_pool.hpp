@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace asciiplay {
+
+// Ref-counted handle to a buffer leased from a FramePool. Copies share the
+// same storage; the buffer goes back to its pool when the last copy is gone.
+template <typename T>
+class FrameBuffer {
+public:
+    FrameBuffer() = default;
+    explicit FrameBuffer(std::shared_ptr<std::vector<T>> storage) : storage_(std::move(storage)) {}
+
+    T* data() { return storage_ ? storage_->data() : nullptr; }
+    const T* data() const { return storage_ ? storage_->data() : nullptr; }
+    size_t size() const { return storage_ ? storage_->size() : 0; }
+    bool empty() const { return size() == 0; }
+    T* begin() { return data(); }
+    T* end() { return data() + size(); }
+    const T* begin() const { return data(); }
+    const T* end() const { return data() + size(); }
+
+    // Shrinking keeps the capacity, so a trimmed lease is still reusable.
+    void resize(size_t count)
+    {
+        if (!storage_) storage_ = std::make_shared<std::vector<T>>();
+        storage_->resize(count);
+    }
+
+private:
+    std::shared_ptr<std::vector<T>> storage_;
+};
+
+// Bounded free list of decode buffers. Steady-state decoding recycles the
+// same few allocations instead of allocating and copying one per frame.
+template <typename T>
+class FramePool {
+public:
+    explicit FramePool(size_t capacity) : shelf_(std::make_shared<Shelf>())
+    {
+        shelf_->capacity = capacity;
+    }
+
+    // Hands out a buffer of `count` elements; the contents are unspecified.
+    FrameBuffer<T> acquire(size_t count)
+    {
+        std::unique_ptr<std::vector<T>> buffer;
+        {
+            std::lock_guard<std::mutex> lock(shelf_->mutex);
+            if (!shelf_->free.empty()) {
+                buffer = std::move(shelf_->free.back());
+                shelf_->free.pop_back();
+            }
+        }
+        if (!buffer) buffer = std::make_unique<std::vector<T>>();
+        buffer->resize(count);
+
+        // The shelf is held weakly so leases may safely outlive the pool.
+        std::weak_ptr<Shelf> weakShelf = shelf_;
+        std::shared_ptr<std::vector<T>> storage(buffer.release(), [weakShelf](std::vector<T>* released) {
+            std::unique_ptr<std::vector<T>> owned(released);
+            if (auto shelf = weakShelf.lock()) {
+                std::lock_guard<std::mutex> lock(shelf->mutex);
+                if (shelf->free.size() < shelf->capacity) {
+                    shelf->free.push_back(std::move(owned));
+                }
+            }
+        });
+        return FrameBuffer<T>(std::move(storage));
+    }
+
+private:
+    struct Shelf {
+        std::mutex mutex;
+        size_t capacity = 0;
+        std::vector<std::unique_ptr<std::vector<T>>> free;
+    };
+
+    std::shared_ptr<Shelf> shelf_;
+};
+
+} // namespace asciiplay
@@ -22,24 +22,52 @@ using namespace asciiplay;
 
 namespace {
 
+// Probe limits --live uses unless given explicitly: enough for the stream
+// parameters of a live feed without waiting on FFmpeg's 5 s default.
+constexpr int64_t kLiveProbeSize = 500 * 1000;
+constexpr double kLiveAnalyzeSeconds = 0.5;
+
 struct CommandLineOptions {
     std::string input;
+    bool live = false;
+    std::string inputFormat;
+    std::vector<std::pair<std::string, std::string>> inputOptions;
+    std::optional<int64_t> probeSize;
+    std::optional<double> analyzeDuration;
     RenderMode mode = RenderMode::ANSI256;
     std::optional<std::pair<int, int>> grid;
+    bool autoGrid = false;
     bool halfblock = false;
     std::optional<double> fps;
+    double start = 0.0;
+    double duration = 0.0;
     bool noAudio = false;
     int volume = 100;
     std::optional<std::string> exportFile;
+    std::optional<std::string> cacheOut;
+    std::optional<std::pair<std::string, int>> serve;
+    bool batch = false;
     std::optional<std::pair<int, int>> exportGrid;
     std::optional<std::pair<int, int>> exportFont;
     int exportCrf = 18;
     std::optional<double> exportFps;
+    int exportThreads = 0;
+    std::string exportPreset = "medium";
+    int exportEncoderThreads = 0;
     DitherMode dither = DitherMode::Bayer4;
     float gamma = 2.2f;
     float contrast = 1.0f;
     double maxWrite = 100.0;
     bool stats = false;
+    std::string metricsOut;
+    int decodeScale = 2;
+    int renderThreads = 1;
+    bool incremental = false;
+    double diffThreshold = 0.0;
+    int decodeThreads = 0;
+    std::string hwAccel;
+    std::optional<int> queueDepth;
+    QueuePolicy queuePolicy = QueuePolicy::Block;
 };
 
 std::optional<std::pair<int, int>> parseDimension(const std::string& value)
@@ -56,13 +84,39 @@ std::optional<std::pair<int, int>> parseDimension(const std::string& value)
     }
 }
 
+// Seconds, or [hh:]mm:ss[.fff].
+std::optional<double> parseTime(const std::string& value)
+{
+    try {
+        double seconds = 0.0;
+        size_t begin = 0;
+        for (;;) {
+            size_t colon = value.find(':', begin);
+            seconds = seconds * 60.0 + std::stod(value.substr(begin, colon - begin));
+            if (colon == std::string::npos) break;
+            begin = colon + 1;
+        }
+        if (seconds < 0.0) return std::nullopt;
+        return seconds;
+    } catch (...) {
+        return std::nullopt;
+    }
+}
+
 void printHelp()
 {
-    std::cout << "asciiplay <input> [options]\n"
+    std::cout << "asciiplay <input|-> [options]\n"
+              << "  --live (low latency: newest frame first, no demuxer buffering)\n"
+              << "  --input-format <demuxer, e.g. v4l2, dshow, mpegts>\n"
+              << "  --input-option <key>=<value> (repeatable, passed to the demuxer)\n"
+              << "  --probesize <bytes>\n"
+              << "  --analyzeduration <seconds>\n"
               << "  --mode {gray,256,truecolor}\n"
-              << "  --grid <cols>x<rows>\n"
+              << "  --grid <cols>x<rows>|auto\n"
               << "  --halfblock {on|off}\n"
               << "  --fps <num>\n"
+              << "  --start <seconds|[hh:]mm:ss>\n"
+              << "  --duration <seconds|[hh:]mm:ss>\n"
               << "  --no-audio\n"
               << "  --volume <0..200>\n"
               << "  --export <outfile.mp4>\n"
@@ -70,11 +124,26 @@ void printHelp()
               << "  --export-font <w>x<h>\n"
               << "  --export-crf <0..51>\n"
               << "  --export-fps <num>\n"
-              << "  --dither {off,bayer2,bayer4}\n"
+              << "  --export-threads <n, 0 = auto>\n"
+              << "  --cache-out <outfile.asciicache>\n"
+              << "  --serve [<addr>:]<port> (broadcast to TCP clients; send \"mode full|256|mono\")\n"
+              << "  --batch (headless run with progress lines, requires --export or --cache-out)\n"
+              << "  --export-preset <ultrafast..veryslow>\n"
+              << "  --export-encoder-threads <n, 0 = auto>\n"
+              << "  --dither {off,bayer2,bayer4,bluenoise,fs,serpentine}\n"
               << "  --gamma <float>\n"
               << "  --contrast <float>\n"
               << "  --maxwrite <MBps>\n"
+              << "  --decode-scale <samples per cell, 0 = native>\n"
+              << "  --render-threads <n, 0 = auto>\n"
+              << "  --incremental (re-render only cells whose source changed)\n"
+              << "  --decode-threads <n, 0 = auto>\n"
+              << "  --hwaccel {auto,vaapi,cuda,d3d11va,videotoolbox,...}\n"
+              << "  --diff <0..1, changed fraction before full redraw; 0 = off>\n"
+              << "  --queue-depth <frames per stage queue>\n"
+              << "  --queue-policy {block,drop-oldest}\n"
               << "  --stats\n"
+              << "  --metrics-out <file.csv|file.json>\n"
               << "  --help\n";
 }
 
@@ -96,7 +165,27 @@ std::optional<CommandLineOptions> parseArgs(int argc, char** argv)
             return true;
         };
 
-        if (arg == "--mode") {
+        if (arg == "--live") {
+            opts.live = true;
+        } else if (arg == "--input-format") {
+            if (!nextValue(opts.inputFormat)) return std::nullopt;
+        } else if (arg == "--input-option") {
+            std::string value;
+            if (!nextValue(value)) return std::nullopt;
+            auto pos = value.find('=');
+            if (pos == std::string::npos || pos == 0) return std::nullopt;
+            opts.inputOptions.emplace_back(value.substr(0, pos), value.substr(pos + 1));
+        } else if (arg == "--probesize") {
+            std::string value;
+            if (!nextValue(value)) return std::nullopt;
+            opts.probeSize = std::stoll(value);
+            if (*opts.probeSize < 32) return std::nullopt;
+        } else if (arg == "--analyzeduration") {
+            std::string value;
+            if (!nextValue(value)) return std::nullopt;
+            opts.analyzeDuration = std::stod(value);
+            if (*opts.analyzeDuration < 0.0) return std::nullopt;
+        } else if (arg == "--mode") {
             std::string value;
             if (!nextValue(value)) return std::nullopt;
             if (value == "gray") opts.mode = RenderMode::Gray;
@@ -106,6 +195,10 @@ std::optional<CommandLineOptions> parseArgs(int argc, char** argv)
         } else if (arg == "--grid") {
             std::string value;
             if (!nextValue(value)) return std::nullopt;
+            if (value == "auto") {
+                opts.autoGrid = true;
+                continue;
+            }
             opts.grid = parseDimension(value);
             if (!opts.grid) return std::nullopt;
         } else if (arg == "--halfblock") {
@@ -116,6 +209,12 @@ std::optional<CommandLineOptions> parseArgs(int argc, char** argv)
             std::string value;
             if (!nextValue(value)) return std::nullopt;
             opts.fps = std::stod(value);
+        } else if (arg == "--start" || arg == "--duration") {
+            std::string value;
+            if (!nextValue(value)) return std::nullopt;
+            auto seconds = parseTime(value);
+            if (!seconds) return std::nullopt;
+            (arg == "--start" ? opts.start : opts.duration) = *seconds;
         } else if (arg == "--no-audio") {
             opts.noAudio = true;
         } else if (arg == "--volume") {
@@ -144,12 +243,41 @@ std::optional<CommandLineOptions> parseArgs(int argc, char** argv)
             std::string value;
             if (!nextValue(value)) return std::nullopt;
             opts.exportFps = std::stod(value);
+        } else if (arg == "--export-threads") {
+            std::string value;
+            if (!nextValue(value)) return std::nullopt;
+            opts.exportThreads = std::stoi(value);
+            if (opts.exportThreads < 0) return std::nullopt;
+        } else if (arg == "--cache-out") {
+            std::string value;
+            if (!nextValue(value)) return std::nullopt;
+            opts.cacheOut = value;
+        } else if (arg == "--serve") {
+            std::string value;
+            if (!nextValue(value)) return std::nullopt;
+            auto colon = value.rfind(':');
+            std::string address = colon == std::string::npos ? "0.0.0.0" : value.substr(0, colon);
+            int port = std::stoi(colon == std::string::npos ? value : value.substr(colon + 1));
+            if (port <= 0 || port > 65535) return std::nullopt;
+            opts.serve = std::make_pair(address, port);
+        } else if (arg == "--batch") {
+            opts.batch = true;
+        } else if (arg == "--export-preset") {
+            if (!nextValue(opts.exportPreset)) return std::nullopt;
+        } else if (arg == "--export-encoder-threads") {
+            std::string value;
+            if (!nextValue(value)) return std::nullopt;
+            opts.exportEncoderThreads = std::stoi(value);
+            if (opts.exportEncoderThreads < 0) return std::nullopt;
         } else if (arg == "--dither") {
             std::string value;
             if (!nextValue(value)) return std::nullopt;
             if (value == "off") opts.dither = DitherMode::Off;
             else if (value == "bayer2") opts.dither = DitherMode::Bayer2;
             else if (value == "bayer4") opts.dither = DitherMode::Bayer4;
+            else if (value == "bluenoise") opts.dither = DitherMode::BlueNoise;
+            else if (value == "fs") opts.dither = DitherMode::FloydSteinberg;
+            else if (value == "serpentine") opts.dither = DitherMode::Serpentine;
             else return std::nullopt;
         } else if (arg == "--gamma") {
             std::string value;
@@ -163,8 +291,45 @@ std::optional<CommandLineOptions> parseArgs(int argc, char** argv)
             std::string value;
             if (!nextValue(value)) return std::nullopt;
             opts.maxWrite = std::stod(value);
+        } else if (arg == "--decode-scale") {
+            std::string value;
+            if (!nextValue(value)) return std::nullopt;
+            opts.decodeScale = std::stoi(value);
+            if (opts.decodeScale < 0) return std::nullopt;
+        } else if (arg == "--render-threads") {
+            std::string value;
+            if (!nextValue(value)) return std::nullopt;
+            opts.renderThreads = std::stoi(value);
+            if (opts.renderThreads < 0) return std::nullopt;
+        } else if (arg == "--decode-threads") {
+            std::string value;
+            if (!nextValue(value)) return std::nullopt;
+            opts.decodeThreads = std::stoi(value);
+            if (opts.decodeThreads < 0) return std::nullopt;
+        } else if (arg == "--hwaccel") {
+            if (!nextValue(opts.hwAccel)) return std::nullopt;
+        } else if (arg == "--diff") {
+            std::string value;
+            if (!nextValue(value)) return std::nullopt;
+            opts.diffThreshold = std::stod(value);
+            if (opts.diffThreshold < 0.0 || opts.diffThreshold > 1.0) return std::nullopt;
+        } else if (arg == "--queue-depth") {
+            std::string value;
+            if (!nextValue(value)) return std::nullopt;
+            opts.queueDepth = std::stoi(value);
+            if (*opts.queueDepth <= 0) return std::nullopt;
+        } else if (arg == "--queue-policy") {
+            std::string value;
+            if (!nextValue(value)) return std::nullopt;
+            if (value == "block") opts.queuePolicy = QueuePolicy::Block;
+            else if (value == "drop-oldest") opts.queuePolicy = QueuePolicy::DropOldest;
+            else return std::nullopt;
+        } else if (arg == "--incremental") {
+            opts.incremental = true;
         } else if (arg == "--stats") {
             opts.stats = true;
+        } else if (arg == "--metrics-out") {
+            if (!nextValue(opts.metricsOut)) return std::nullopt;
         } else if (arg == "--help") {
             printHelp();
             return std::nullopt;
@@ -197,11 +362,43 @@ int main(int argc, char** argv)
     std::signal(SIGINT, handleSignal);
 #ifndef _WIN32
     std::signal(SIGTERM, handleSignal);
+    // A closed stdout should fail the write (EPIPE), not kill the process.
+    std::signal(SIGPIPE, SIG_IGN);
 #endif
 
+    bool headless = opts->exportFile || opts->cacheOut;
+    if (opts->serve && headless) {
+        std::cerr << "--serve cannot be combined with --export or --cache-out" << std::endl;
+        return 1;
+    }
+    if (opts->batch && !headless) {
+        std::cerr << "--batch requires --export or --cache-out" << std::endl;
+        return 1;
+    }
+
+    // "-" reads the stream from stdin, which then cannot double as the keyboard.
+    bool stdinInput = opts->input == "-";
+
     DecoderOptions decoderOpt;
-    decoderOpt.url = opts->input;
-    decoderOpt.enableAudio = !opts->noAudio;
+    decoderOpt.url = stdinInput ? "pipe:0" : opts->input;
+    decoderOpt.inputFormat = opts->inputFormat;
+    decoderOpt.inputOptions = opts->inputOptions;
+    decoderOpt.lowLatency = opts->live;
+    if (opts->live) {
+        decoderOpt.probeSize = kLiveProbeSize;
+        decoderOpt.analyzeDuration = static_cast<int64_t>(kLiveAnalyzeSeconds * 1e6);
+    }
+    if (opts->probeSize) decoderOpt.probeSize = *opts->probeSize;
+    if (opts->analyzeDuration) decoderOpt.analyzeDuration = static_cast<int64_t>(*opts->analyzeDuration * 1e6);
+    decoderOpt.start = opts->start;
+    decoderOpt.duration = opts->duration;
+    // A cache holds no audio, so only playback and export decode it.
+    // Network clients get no audio either.
+    decoderOpt.enableAudio = !opts->noAudio && (opts->exportFile || (!opts->cacheOut && !opts->serve));
+    // Exports remux the compressed audio instead of playing it.
+    decoderOpt.audioPassthrough = opts->exportFile.has_value();
+    decoderOpt.decodeThreads = opts->decodeThreads;
+    decoderOpt.hwDevice = opts->hwAccel;
 
     PipelineConfig pipelineCfg;
     pipelineCfg.renderer.mode = opts->mode;
@@ -209,16 +406,61 @@ int main(int argc, char** argv)
     pipelineCfg.renderer.halfBlock = opts->halfblock;
     pipelineCfg.renderer.gamma = opts->gamma;
     pipelineCfg.renderer.contrast = opts->contrast;
+    pipelineCfg.renderer.renderThreads = opts->renderThreads;
+    pipelineCfg.renderer.incremental = opts->incremental;
+    if (opts->incremental && is_error_diffusion(opts->dither)) {
+        std::cerr << "Warning: --incremental has no effect with error-diffusion dithering" << std::endl;
+    }
     if (opts->grid) {
         pipelineCfg.renderer.gridCols = opts->grid->first;
         pipelineCfg.renderer.gridRows = opts->grid->second;
     }
-    pipelineCfg.audio.enabled = !opts->noAudio;
+    pipelineCfg.autoGrid = opts->autoGrid;
+    pipelineCfg.audio.enabled = !opts->noAudio && !headless && !opts->serve;
     pipelineCfg.audio.volume = static_cast<float>(opts->volume) / 100.0f;
     pipelineCfg.terminal.maxWriteMBps = opts->maxWrite;
+    pipelineCfg.terminal.diffThreshold = opts->diffThreshold;
     pipelineCfg.showStats = opts->stats;
+    pipelineCfg.metricsOut = opts->metricsOut;
     pipelineCfg.targetFps = opts->fps.value_or(0.0);
+    pipelineCfg.decodeScale = opts->decodeScale;
+    if (opts->queueDepth) {
+        decoderOpt.videoQueueDepth = static_cast<size_t>(*opts->queueDepth);
+        pipelineCfg.asciiQueueDepth = static_cast<size_t>(*opts->queueDepth);
+        pipelineCfg.exporter.queueDepth = static_cast<size_t>(*opts->queueDepth);
+    }
+    if (headless && opts->queuePolicy == QueuePolicy::DropOldest) {
+        std::cerr << "Warning: --queue-policy drop-oldest ignored while exporting or caching" << std::endl;
+    } else {
+        decoderOpt.videoQueuePolicy = opts->queuePolicy;
+        pipelineCfg.asciiQueuePolicy = opts->queuePolicy;
+    }
+    if (opts->live && !headless) {
+        // Only the newest frame is worth showing; exports of a live feed
+        // still keep every frame.
+        decoderOpt.videoQueueDepth = 1;
+        decoderOpt.videoQueuePolicy = QueuePolicy::DropOldest;
+        pipelineCfg.asciiQueueDepth = 1;
+        pipelineCfg.asciiQueuePolicy = QueuePolicy::DropOldest;
+        pipelineCfg.lowLatency = true;
+    }
+    pipelineCfg.terminal.keyboard = !stdinInput;
 
+    pipelineCfg.batch = opts->batch;
+    if (opts->serve) {
+        pipelineCfg.network.address = opts->serve->first;
+        pipelineCfg.network.port = opts->serve->second;
+        if (opts->diffThreshold > 0.0) pipelineCfg.network.diffThreshold = opts->diffThreshold;
+    }
+    if (opts->cacheOut) {
+        pipelineCfg.cacheOut = *opts->cacheOut;
+    }
+    if (!stdinInput && AsciiCacheReader::probe(opts->input)) {
+        pipelineCfg.cacheIn = opts->input;
+        if (opts->start > 0.0 || opts->duration > 0.0) {
+            std::cerr << "Warning: --start and --duration are ignored when playing a cache" << std::endl;
+        }
+    }
     if (opts->exportFile) {
         pipelineCfg.exportEnabled = true;
         pipelineCfg.exporter.outputFile = *opts->exportFile;
@@ -229,6 +471,9 @@ int main(int argc, char** argv)
             pipelineCfg.exporter.fontH = opts->exportFont->second;
         }
         pipelineCfg.exporter.crf = opts->exportCrf;
+        pipelineCfg.exporter.threads = opts->exportThreads;
+        pipelineCfg.exporter.encoderThreads = opts->exportEncoderThreads;
+        pipelineCfg.exporter.preset = opts->exportPreset;
         pipelineCfg.exporter.fps = opts->exportFps ? static_cast<int>(*opts->exportFps) : (opts->fps ? static_cast<int>(*opts->fps) : 30);
     }
 
@@ -0,0 +1,132 @@
+#include "metrics.hpp"
+
+namespace asciiplay {
+
+namespace {
+
+double percentile(const LatencyHistogram::Snapshot& now, const LatencyHistogram::Snapshot& before,
+                  uint64_t count, double fraction)
+{
+    uint64_t rank = static_cast<uint64_t>(fraction * static_cast<double>(count - 1));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LatencyHistogram::kBuckets; ++i) {
+        seen += now[i] - before[i];
+        if (seen > rank) {
+            // Middle of the bucket.
+            double low = static_cast<double>(LatencyHistogram::bucketValue(i));
+            double high = i + 1 < LatencyHistogram::kBuckets
+                ? static_cast<double>(LatencyHistogram::bucketValue(i + 1))
+                : low;
+            return (low + high) * 0.5 / 1e6;
+        }
+    }
+    return 0.0;
+}
+
+} // namespace
+
+LatencySummary summarize(const LatencyHistogram::Snapshot& now, const LatencyHistogram::Snapshot& before)
+{
+    LatencySummary summary;
+    for (size_t i = 0; i < LatencyHistogram::kBuckets; ++i) summary.count += now[i] - before[i];
+    if (summary.count == 0) return summary;
+    summary.p50Ms = percentile(now, before, summary.count, 0.50);
+    summary.p99Ms = percentile(now, before, summary.count, 0.99);
+    return summary;
+}
+
+const char* stage_name(Stage stage)
+{
+    switch (stage) {
+    case Stage::Decode: return "decode";
+    case Stage::Scale: return "scale";
+    case Stage::Render: return "render";
+    case Stage::Encode: return "encode";
+    case Stage::Present: return "present";
+    case Stage::ExportRaster: return "export_raster";
+    case Stage::ExportEncode: return "export_encode";
+    default: return "?";
+    }
+}
+
+MetricsWriter::~MetricsWriter()
+{
+    close();
+}
+
+bool MetricsWriter::open(const std::string& path, std::string& err)
+{
+    close();
+    file_ = std::fopen(path.c_str(), "w");
+    if (!file_) {
+        err = "Failed to open metrics file " + path;
+        return false;
+    }
+    json_ = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    headerWritten_ = false;
+    return true;
+}
+
+void MetricsWriter::close()
+{
+    if (file_) {
+        std::fclose(file_);
+        file_ = nullptr;
+    }
+}
+
+void MetricsWriter::writeCsvHeader(const MetricsSample& sample)
+{
+    std::fputs("time,fps,rendered,dropped", file_);
+    for (size_t i = 0; i < kStageCount; ++i) {
+        const char* name = stage_name(static_cast<Stage>(i));
+        std::fprintf(file_, ",%s_count,%s_p50_ms,%s_p99_ms", name, name, name);
+    }
+    for (const auto& queue : sample.queues) {
+        std::fprintf(file_, ",%s_depth,%s_capacity", queue.first, queue.first);
+    }
+    std::fputs(",bytes_per_sec,av_drift_ms\n", file_);
+    headerWritten_ = true;
+}
+
+void MetricsWriter::write(const MetricsSample& sample)
+{
+    if (!file_) return;
+    if (json_) {
+        std::fprintf(file_, "{\"time\":%.3f,\"fps\":%.2f,\"rendered\":%llu,\"dropped\":%llu,\"stages\":{",
+                     sample.elapsed, sample.fps, static_cast<unsigned long long>(sample.rendered),
+                     static_cast<unsigned long long>(sample.dropped));
+        for (size_t i = 0; i < kStageCount; ++i) {
+            const LatencySummary& s = sample.stages[i];
+            std::fprintf(file_, "%s\"%s\":{\"count\":%llu,\"p50_ms\":%.3f,\"p99_ms\":%.3f}", i ? "," : "",
+                         stage_name(static_cast<Stage>(i)), static_cast<unsigned long long>(s.count), s.p50Ms, s.p99Ms);
+        }
+        std::fputs("},\"queues\":{", file_);
+        for (size_t i = 0; i < sample.queues.size(); ++i) {
+            const auto& queue = sample.queues[i];
+            std::fprintf(file_, "%s\"%s\":{\"depth\":%zu,\"capacity\":%zu}", i ? "," : "", queue.first,
+                         queue.second.depth, queue.second.capacity);
+        }
+        std::fprintf(file_, "},\"bytes_per_sec\":%.0f", sample.bytesPerSecond);
+        if (sample.haveDrift) {
+            std::fprintf(file_, ",\"av_drift_ms\":%.1f", sample.avDriftMs);
+        }
+        std::fputs("}\n", file_);
+    } else {
+        if (!headerWritten_) writeCsvHeader(sample);
+        std::fprintf(file_, "%.3f,%.2f,%llu,%llu", sample.elapsed, sample.fps,
+                     static_cast<unsigned long long>(sample.rendered), static_cast<unsigned long long>(sample.dropped));
+        for (const LatencySummary& s : sample.stages) {
+            std::fprintf(file_, ",%llu,%.3f,%.3f", static_cast<unsigned long long>(s.count), s.p50Ms, s.p99Ms);
+        }
+        for (const auto& queue : sample.queues) {
+            std::fprintf(file_, ",%zu,%zu", queue.second.depth, queue.second.capacity);
+        }
+        std::fprintf(file_, ",%.0f,", sample.bytesPerSecond);
+        if (sample.haveDrift) std::fprintf(file_, "%.1f", sample.avDriftMs);
+        std::fputc('\n', file_);
+    }
+    std::fflush(file_);
+}
+
+} // namespace asciiplay
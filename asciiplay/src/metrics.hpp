@@ -0,0 +1,134 @@
+#pragma once
+
+#include "stage_queue.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace asciiplay {
+
+// Log-linear histogram of durations in nanoseconds: eight buckets per power
+// of two, so a percentile read back is within about 6% of the true value.
+// record() is one relaxed atomic increment and may be called from any thread.
+class LatencyHistogram {
+public:
+    static constexpr int kSubBuckets = 8;
+    // The last bucket starts at 15 * 2^36 ns (about 17 minutes) and also
+    // takes everything longer; below that the 8-per-octave resolution holds.
+    static constexpr size_t kBuckets = 38 * kSubBuckets;
+    using Snapshot = std::array<uint64_t, kBuckets>;
+
+    void record(uint64_t nanos)
+    {
+        counts_[bucketOf(nanos)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void record(std::chrono::steady_clock::duration elapsed)
+    {
+        auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        record(static_cast<uint64_t>(nanos > 0 ? nanos : 0));
+    }
+
+    Snapshot snapshot() const
+    {
+        Snapshot out{};
+        for (size_t i = 0; i < kBuckets; ++i) out[i] = counts_[i].load(std::memory_order_relaxed);
+        return out;
+    }
+
+    // Bucket i covers [value(i), value(i + 1)).
+    static uint64_t bucketValue(size_t index)
+    {
+        if (index < 2 * kSubBuckets) return index;
+        size_t shift = index / kSubBuckets - 1;
+        return static_cast<uint64_t>(index - shift * kSubBuckets) << shift;
+    }
+
+private:
+    static size_t bucketOf(uint64_t nanos)
+    {
+        if (nanos < 2 * kSubBuckets) return static_cast<size_t>(nanos);
+        // Keep the top four bits: shift * 8 + (nanos >> shift), with the
+        // shifted value in [8, 16).
+        size_t shift = 0;
+#if defined(__GNUC__) || defined(__clang__)
+        shift = static_cast<size_t>(60 - __builtin_clzll(nanos));
+#else
+        while ((nanos >> shift) >= 2 * kSubBuckets) ++shift;
+#endif
+        size_t index = shift * kSubBuckets + static_cast<size_t>(nanos >> shift);
+        return index < kBuckets ? index : kBuckets - 1;
+    }
+
+    std::array<std::atomic<uint64_t>, kBuckets> counts_{};
+};
+
+struct LatencySummary {
+    uint64_t count = 0;
+    double p50Ms = 0.0;
+    double p99Ms = 0.0;
+};
+
+// Percentiles of what was recorded between two snapshots.
+LatencySummary summarize(const LatencyHistogram::Snapshot& now, const LatencyHistogram::Snapshot& before);
+
+// Timed pipeline stages, in the order they are reported.
+enum class Stage {
+    Decode,       // codec work per decoded frame
+    Scale,        // hardware download and sws_scale
+    Render,       // cell sampling and the full terminal string
+    Encode,       // delta / degraded escape encoding in the terminal sink
+    Present,      // the terminal write
+    ExportRaster, // glyph rasterization of an exported frame
+    ExportEncode, // video encoder send and drain
+    Count
+};
+
+constexpr size_t kStageCount = static_cast<size_t>(Stage::Count);
+
+const char* stage_name(Stage stage);
+
+// One throttled reading of the whole pipeline.
+struct MetricsSample {
+    double elapsed = 0.0; // seconds since playback started
+    double fps = 0.0;
+    uint64_t rendered = 0;
+    uint64_t dropped = 0;
+    std::array<LatencySummary, kStageCount> stages{};
+    std::vector<std::pair<const char*, QueueStats>> queues;
+    double bytesPerSecond = 0.0; // terminal, network or export output
+    bool haveDrift = false;
+    double avDriftMs = 0.0; // video pts minus the audio clock
+};
+
+// Appends samples to a metrics file: one JSON object per line when the path
+// ends in ".json", CSV with a header row otherwise.
+class MetricsWriter {
+public:
+    MetricsWriter() = default;
+    ~MetricsWriter();
+
+    MetricsWriter(const MetricsWriter&) = delete;
+    MetricsWriter& operator=(const MetricsWriter&) = delete;
+
+    bool open(const std::string& path, std::string& err);
+    void write(const MetricsSample& sample);
+    void close();
+    bool isOpen() const { return file_ != nullptr; }
+
+private:
+    void writeCsvHeader(const MetricsSample& sample);
+
+    std::FILE* file_ = nullptr;
+    bool json_ = false;
+    bool headerWritten_ = false;
+};
+
+} // namespace asciiplay
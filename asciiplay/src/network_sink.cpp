@@ -0,0 +1,465 @@
+#include "network_sink.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#endif
+
+namespace asciiplay {
+
+namespace {
+#ifdef _WIN32
+// WSAPoll cannot wait on a pipe, so broadcasts are picked up by timeout.
+constexpr int kPollTimeoutMs = 5;
+#else
+constexpr int kPollTimeoutMs = 100;
+#endif
+constexpr int kListenBacklog = 64;
+constexpr size_t kMaxCommandBytes = 64;
+constexpr char kGreeting[] = "\x1b[?25l\x1b[2J";
+constexpr char kClearScreen[] = "\x1b[2J";
+constexpr char kHome[] = "\x1b[H";
+
+#ifdef _WIN32
+using socket_t = SOCKET;
+#else
+using socket_t = int;
+#endif
+
+socket_t to_socket(intptr_t fd)
+{
+    return static_cast<socket_t>(fd);
+}
+
+void close_socket(intptr_t fd)
+{
+    if (fd < 0) return;
+#ifdef _WIN32
+    ::closesocket(to_socket(fd));
+#else
+    ::close(static_cast<int>(fd));
+#endif
+}
+
+bool set_nonblocking(intptr_t fd)
+{
+#ifdef _WIN32
+    u_long enabled = 1;
+    return ::ioctlsocket(to_socket(fd), FIONBIO, &enabled) == 0;
+#else
+    int flags = ::fcntl(static_cast<int>(fd), F_GETFL, 0);
+    return flags >= 0 && ::fcntl(static_cast<int>(fd), F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+bool would_block()
+{
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+long send_some(intptr_t fd, const char* data, size_t size)
+{
+#ifdef _WIN32
+    return ::send(to_socket(fd), data, static_cast<int>(std::min<size_t>(size, 1u << 30)), 0);
+#elif defined(MSG_NOSIGNAL)
+    return static_cast<long>(::send(static_cast<int>(fd), data, size, MSG_NOSIGNAL));
+#else
+    return static_cast<long>(::send(static_cast<int>(fd), data, size, 0));
+#endif
+}
+
+long recv_some(intptr_t fd, char* data, size_t size)
+{
+#ifdef _WIN32
+    return ::recv(to_socket(fd), data, static_cast<int>(size), 0);
+#else
+    return static_cast<long>(::recv(static_cast<int>(fd), data, size, 0));
+#endif
+}
+
+#ifdef __linux__
+// Markers stored in epoll_event::data.ptr for the two non-client sockets.
+char gListenTag;
+char gWakeTag;
+
+void watch(intptr_t pollFd, intptr_t fd, void* tag, bool writable, int op)
+{
+    epoll_event event{};
+    event.events = writable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    event.data.ptr = tag;
+    ::epoll_ctl(static_cast<int>(pollFd), op, static_cast<int>(fd), &event);
+}
+#endif
+}
+
+NetworkSink::NetworkSink() = default;
+
+NetworkSink::~NetworkSink()
+{
+    stop();
+}
+
+bool NetworkSink::start(const NetworkConfig& cfg, std::string& err)
+{
+    config_ = cfg;
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        err = "Failed to initialize sockets";
+        return false;
+    }
+#endif
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(config_.port));
+    if (::inet_pton(AF_INET, config_.address.c_str(), &addr.sin_addr) != 1) {
+        err = "Invalid listen address";
+        return false;
+    }
+
+    listenFd_ = static_cast<intptr_t>(::socket(AF_INET, SOCK_STREAM, 0));
+    if (listenFd_ < 0) {
+        err = "Failed to create socket";
+        return false;
+    }
+    int reuse = 1;
+    ::setsockopt(to_socket(listenFd_), SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+    if (::bind(to_socket(listenFd_), reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::listen(to_socket(listenFd_), kListenBacklog) != 0 || !set_nonblocking(listenFd_)) {
+        err = "Failed to listen on port " + std::to_string(config_.port);
+        close_socket(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+
+#ifndef _WIN32
+    int wakeFds[2];
+    if (::pipe(wakeFds) != 0) {
+        err = "Failed to create wake pipe";
+        close_socket(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+    wakeRead_ = wakeFds[0];
+    wakeWrite_ = wakeFds[1];
+    set_nonblocking(wakeRead_);
+    set_nonblocking(wakeWrite_);
+#endif
+#ifdef __linux__
+    pollFd_ = ::epoll_create1(0);
+    watch(pollFd_, listenFd_, &gListenTag, false, EPOLL_CTL_ADD);
+    watch(pollFd_, wakeRead_, &gWakeTag, false, EPOLL_CTL_ADD);
+#endif
+
+    running_ = true;
+    ioThread_ = std::thread(&NetworkSink::ioLoop, this);
+    return true;
+}
+
+void NetworkSink::stop()
+{
+    if (!running_.exchange(false)) return;
+    wake();
+    if (ioThread_.joinable()) ioThread_.join();
+
+    for (auto& client : clients_) close_socket(client->fd);
+    clients_.clear();
+    variantUsers_ = {};
+    clientCount_ = 0;
+    close_socket(listenFd_);
+#ifndef _WIN32
+    if (wakeRead_ >= 0) ::close(static_cast<int>(wakeRead_));
+    if (wakeWrite_ >= 0) ::close(static_cast<int>(wakeWrite_));
+#endif
+#ifdef __linux__
+    if (pollFd_ >= 0) ::close(static_cast<int>(pollFd_));
+#endif
+    listenFd_ = wakeRead_ = wakeWrite_ = pollFd_ = -1;
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+EncodeOptions NetworkSink::variantOptions(StreamVariant variant, const AsciiFrame& frame) const
+{
+    EncodeOptions options{frame.mode, frame.halfBlock};
+    options.palette256 = variant == StreamVariant::Palette256;
+    options.monochrome = variant == StreamVariant::Mono;
+    return options;
+}
+
+void NetworkSink::broadcast(const AsciiFrame& frame)
+{
+    if (!running_) return;
+
+    constexpr size_t kVariants = static_cast<size_t>(StreamVariant::Count);
+    std::array<size_t, kVariants> users{};
+    std::array<bool, kVariants> wantKey{};
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        users = variantUsers_;
+        for (const auto& client : clients_) {
+            if (client->needKeyFrame) wantKey[static_cast<size_t>(client->variant)] = true;
+        }
+    }
+
+    // Encode each variant in use once; every client on it shares the bytes.
+    std::array<Payload, kVariants> deltas;
+    std::array<Payload, kVariants> fulls;
+    std::array<Payload, kVariants> keys;
+    for (size_t v = 0; v < kVariants; ++v) {
+        VariantState& state = variants_[v];
+        if (users[v] == 0) {
+            state.havePrevious = false;
+            continue;
+        }
+        EncodeOptions options = variantOptions(static_cast<StreamVariant>(v), frame);
+        size_t maxChanged = static_cast<size_t>(config_.diffThreshold * frame.cells.size());
+        if (state.havePrevious && encode_delta(frame, state.previous, options, maxChanged, state.buffer)) {
+            deltas[v] = std::make_shared<const std::string>(state.buffer.data(), state.buffer.size());
+        }
+        if (!deltas[v] || wantKey[v]) {
+            state.buffer.clear();
+            char* out = state.buffer.reserveTail(sizeof(kHome) - 1 + max_encoded_rows(frame.cols, frame.rows));
+            out = encode_literal(kHome, out);
+            state.buffer.commit(encode_rows(frame, options, 0, frame.rows, out));
+            auto full = std::make_shared<std::string>(state.buffer.data(), state.buffer.size());
+            if (wantKey[v]) {
+                keys[v] = std::make_shared<const std::string>(kClearScreen + *full);
+            }
+            fulls[v] = std::move(full);
+        }
+        state.previous.cols = frame.cols;
+        state.previous.rows = frame.rows;
+        state.previous.mode = frame.mode;
+        state.previous.halfBlock = frame.halfBlock;
+        state.previous.cells.assign(frame.cells.begin(), frame.cells.end());
+        state.havePrevious = true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& client : clients_) {
+            size_t v = static_cast<size_t>(client->variant);
+            if (client->needKeyFrame) {
+                // Resync only once the backlog, including a half-sent frame, is gone.
+                if (client->queue.empty() && keys[v]) {
+                    client->queue.push_back(keys[v]);
+                    client->needKeyFrame = false;
+                } else {
+                    ++droppedFrames_;
+                }
+                continue;
+            }
+            if (client->queue.size() >= config_.maxQueuedFrames) {
+                // Too slow: drop the backlog but never cut a frame mid-escape.
+                size_t keep = client->frontOffset > 0 ? 1 : 0;
+                droppedFrames_ += client->queue.size() - keep + 1;
+                client->queue.resize(keep);
+                client->needKeyFrame = true;
+                continue;
+            }
+            const Payload& payload = deltas[v] ? deltas[v] : fulls[v];
+            if (payload) client->queue.push_back(payload);
+        }
+    }
+    wake();
+}
+
+void NetworkSink::wake()
+{
+#ifndef _WIN32
+    if (wakeWrite_ < 0) return;
+    char byte = 1;
+    // A full pipe already guarantees a wake-up.
+    ssize_t ignored = ::write(static_cast<int>(wakeWrite_), &byte, 1);
+    (void)ignored;
+#endif
+}
+
+void NetworkSink::ioLoop()
+{
+    std::vector<Client*> readable;
+    bool acceptPending = false;
+#ifndef __linux__
+    std::vector<pollfd> fds;
+    std::vector<Client*> polled;
+#endif
+    while (running_) {
+        readable.clear();
+        acceptPending = false;
+#ifdef __linux__
+        epoll_event events[64];
+        int count = ::epoll_wait(static_cast<int>(pollFd_), events, 64, kPollTimeoutMs);
+        for (int i = 0; i < count; ++i) {
+            void* tag = events[i].data.ptr;
+            if (tag == &gListenTag) {
+                acceptPending = true;
+            } else if (tag != &gWakeTag && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                readable.push_back(static_cast<Client*>(tag));
+            }
+        }
+#else
+        fds.clear();
+        polled.clear();
+        fds.push_back(pollfd{to_socket(listenFd_), POLLIN, 0});
+#ifndef _WIN32
+        fds.push_back(pollfd{to_socket(wakeRead_), POLLIN, 0});
+#endif
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& client : clients_) {
+                short events = static_cast<short>(POLLIN | (client->wantsWrite ? POLLOUT : 0));
+                fds.push_back(pollfd{to_socket(client->fd), events, 0});
+                polled.push_back(client.get());
+            }
+        }
+        size_t firstClient = fds.size() - polled.size();
+#ifdef _WIN32
+        int count = ::WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), kPollTimeoutMs);
+#else
+        int count = ::poll(fds.data(), static_cast<nfds_t>(fds.size()), kPollTimeoutMs);
+#endif
+        if (count > 0) {
+            acceptPending = (fds[0].revents & POLLIN) != 0;
+            for (size_t i = firstClient; i < fds.size(); ++i) {
+                if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) readable.push_back(polled[i - firstClient]);
+            }
+        }
+#endif
+#ifndef _WIN32
+        char drain[64];
+        while (::read(static_cast<int>(wakeRead_), drain, sizeof(drain)) > 0) {
+        }
+#endif
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (acceptPending) acceptClients();
+        for (Client* client : readable) {
+            if (client->fd >= 0) readClient(*client);
+        }
+        // Push out whatever broadcast() queued; sockets that fill up are
+        // watched for writability instead.
+        for (auto& client : clients_) {
+            if (client->fd < 0) continue;
+            if (!flushClient(*client)) {
+                closeClient(*client);
+                continue;
+            }
+            bool wantsWrite = !client->queue.empty();
+#ifdef __linux__
+            if (wantsWrite != client->wantsWrite) {
+                watch(pollFd_, client->fd, client.get(), wantsWrite, EPOLL_CTL_MOD);
+            }
+#endif
+            client->wantsWrite = wantsWrite;
+        }
+        clients_.erase(std::remove_if(clients_.begin(), clients_.end(),
+                                      [](const std::unique_ptr<Client>& c) { return c->fd < 0; }),
+                       clients_.end());
+        clientCount_ = clients_.size();
+    }
+}
+
+void NetworkSink::acceptClients()
+{
+    while (true) {
+        intptr_t fd = static_cast<intptr_t>(::accept(to_socket(listenFd_), nullptr, nullptr));
+        if (fd < 0) return;
+        set_nonblocking(fd);
+        int noDelay = 1;
+        ::setsockopt(to_socket(fd), IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+#ifdef SO_NOSIGPIPE
+        int noSigpipe = 1;
+        ::setsockopt(to_socket(fd), SOL_SOCKET, SO_NOSIGPIPE, &noSigpipe, sizeof(noSigpipe));
+#endif
+        auto client = std::make_unique<Client>();
+        client->fd = fd;
+        client->queue.push_back(std::make_shared<const std::string>(kGreeting));
+#ifdef __linux__
+        watch(pollFd_, fd, client.get(), false, EPOLL_CTL_ADD);
+#endif
+        ++variantUsers_[static_cast<size_t>(client->variant)];
+        clients_.push_back(std::move(client));
+    }
+}
+
+void NetworkSink::readClient(Client& client)
+{
+    char buffer[256];
+    while (true) {
+        long n = recv_some(client.fd, buffer, sizeof(buffer));
+        if (n == 0 || (n < 0 && !would_block())) {
+            closeClient(client);
+            return;
+        }
+        if (n < 0) return;
+        for (long i = 0; i < n; ++i) {
+            char c = buffer[i];
+            if (c != '\n') {
+                // Telnet negotiation and other control bytes are ignored.
+                if (c >= 0x20 && c < 0x7F && client.input.size() < kMaxCommandBytes) client.input.push_back(c);
+                continue;
+            }
+            StreamVariant variant = client.variant;
+            if (client.input == "mode full") variant = StreamVariant::Rendered;
+            else if (client.input == "mode 256") variant = StreamVariant::Palette256;
+            else if (client.input == "mode mono") variant = StreamVariant::Mono;
+            client.input.clear();
+            if (variant == client.variant) continue;
+            --variantUsers_[static_cast<size_t>(client.variant)];
+            ++variantUsers_[static_cast<size_t>(variant)];
+            client.variant = variant;
+            client.needKeyFrame = true;
+        }
+    }
+}
+
+bool NetworkSink::flushClient(Client& client)
+{
+    while (!client.queue.empty()) {
+        const std::string& front = *client.queue.front();
+        long n = send_some(client.fd, front.data() + client.frontOffset, front.size() - client.frontOffset);
+        if (n < 0) return would_block();
+        bytesSent_.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+        client.frontOffset += static_cast<size_t>(n);
+        if (client.frontOffset < front.size()) return true;
+        client.queue.pop_front();
+        client.frontOffset = 0;
+    }
+    return true;
+}
+
+void NetworkSink::closeClient(Client& client)
+{
+    if (client.fd < 0) return;
+#ifdef __linux__
+    ::epoll_ctl(static_cast<int>(pollFd_), EPOLL_CTL_DEL, static_cast<int>(client.fd), nullptr);
+#endif
+    close_socket(client.fd);
+    client.fd = -1;
+    client.queue.clear();
+    --variantUsers_[static_cast<size_t>(client.variant)];
+}
+
+} // namespace asciiplay
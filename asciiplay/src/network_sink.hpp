@@ -0,0 +1,108 @@
+#pragma once
+
+#include "ansi_encoder.hpp"
+#include "ascii_renderer.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace asciiplay {
+
+struct NetworkConfig {
+    std::string address = "0.0.0.0";
+    int port = 0;
+    // Frames a client may fall behind before its backlog is dropped and it
+    // is resynchronised with a full frame.
+    size_t maxQueuedFrames = 3;
+    // Delta frames touching more than this fraction of cells go out full.
+    double diffThreshold = 0.5;
+};
+
+// Encodings a client can ask for with a "mode <name>" line.
+enum class StreamVariant {
+    Rendered,   // as rendered: "full"
+    Palette256, // xterm palette indices: "256"
+    Mono,       // glyphs only: "mono"
+    Count
+};
+
+// Broadcasts the rendered terminal stream to any number of TCP clients
+// (telnet, nc). Each frame is encoded once per variant in use and the bytes
+// are shared by every client on that variant. A dedicated thread does the
+// socket I/O: epoll on Linux, poll elsewhere.
+class NetworkSink {
+public:
+    NetworkSink();
+    ~NetworkSink();
+
+    NetworkSink(const NetworkSink&) = delete;
+    NetworkSink& operator=(const NetworkSink&) = delete;
+
+    bool start(const NetworkConfig& cfg, std::string& err);
+    void stop();
+    bool isRunning() const { return running_; }
+    // Queues the frame for every client; never blocks on a slow one.
+    void broadcast(const AsciiFrame& frame);
+
+    size_t clientCount() const { return clientCount_; }
+    // Frames discarded from the queues of clients that fell behind.
+    uint64_t droppedFrames() const { return droppedFrames_; }
+    uint64_t bytesSent() const { return bytesSent_.load(std::memory_order_relaxed); }
+
+private:
+    using Payload = std::shared_ptr<const std::string>;
+
+    struct Client {
+        intptr_t fd = -1;
+        StreamVariant variant = StreamVariant::Rendered;
+        std::deque<Payload> queue;
+        size_t frontOffset = 0; // bytes of queue.front() already sent
+        bool needKeyFrame = true;
+        bool wantsWrite = false;
+        std::string input; // partial command line
+    };
+
+    struct VariantState {
+        AsciiFrame previous;
+        bool havePrevious = false;
+        EncodeBuffer buffer;
+    };
+
+    void ioLoop();
+    void acceptClients();
+    void readClient(Client& client);
+    // False when the connection failed and the client must be dropped.
+    bool flushClient(Client& client);
+    void closeClient(Client& client);
+    void wake();
+    EncodeOptions variantOptions(StreamVariant variant, const AsciiFrame& frame) const;
+
+    NetworkConfig config_;
+    std::atomic<bool> running_{false};
+    std::thread ioThread_;
+    intptr_t listenFd_ = -1;
+    intptr_t wakeRead_ = -1;
+    intptr_t wakeWrite_ = -1;
+    intptr_t pollFd_ = -1; // epoll instance on Linux
+
+    // Clients and their queues, shared by broadcast() and the I/O thread.
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Client>> clients_;
+    std::array<size_t, static_cast<size_t>(StreamVariant::Count)> variantUsers_{};
+
+    // Only touched by broadcast().
+    std::array<VariantState, static_cast<size_t>(StreamVariant::Count)> variants_;
+
+    std::atomic<size_t> clientCount_{0};
+    std::atomic<uint64_t> droppedFrames_{0};
+    std::atomic<uint64_t> bytesSent_{0};
+};
+
+} // namespace asciiplay
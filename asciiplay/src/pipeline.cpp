@@ -1,6 +1,8 @@
 #include "pipeline.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -15,37 +17,132 @@
 
 namespace asciiplay {
 
+namespace {
+// A frame this far behind the audio clock is not worth showing.
+constexpr double kLateFrameSeconds = 0.05;
+// Consecutive late frames before the decoder starts discarding non-reference
+// frames, and consecutive on-time frames before it stops again.
+constexpr int kSkipEnterStreak = 5;
+constexpr int kSkipLeaveStreak = 30;
+// Character cells are about twice as tall as they are wide.
+constexpr double kCellAspect = 2.0;
+// Batch progress lines are printed at most this often.
+constexpr double kProgressIntervalSeconds = 0.5;
+// Stats overlay and metrics file refresh.
+constexpr double kStatsIntervalSeconds = 0.25;
+// Left/right and down/up arrow seek steps.
+constexpr double kSeekShortSeconds = 10.0;
+constexpr double kSeekLongSeconds = 60.0;
+// Arrow keys, numbered past the byte range of ordinary keys.
+constexpr int kKeyUp = 0x100;
+constexpr int kKeyDown = 0x101;
+constexpr int kKeyRight = 0x102;
+constexpr int kKeyLeft = 0x103;
+
+// Next key press without blocking, -1 when there is none.
+int read_key()
+{
+    int key = -1;
+#ifdef _WIN32
+    if (_kbhit()) {
+        key = _getch();
+        // Arrow keys come as a 0 or 0xE0 prefix and a scan code.
+        if (key == 0 || key == 0xE0) {
+            switch (_getch()) {
+            case 72: key = kKeyUp; break;
+            case 80: key = kKeyDown; break;
+            case 77: key = kKeyRight; break;
+            case 75: key = kKeyLeft; break;
+            default: key = -1; break;
+            }
+        }
+    }
+#else
+    unsigned char c = 0;
+    ssize_t n = ::read(STDIN_FILENO, &c, 1);
+    if (n > 0) key = c;
+    // Arrow keys arrive as ESC [ A..D in one burst.
+    unsigned char seq[2] = {};
+    if (key == 0x1b && ::read(STDIN_FILENO, seq, 2) == 2 && seq[0] == '[' && seq[1] >= 'A' && seq[1] <= 'D') {
+        key = kKeyUp + (seq[1] - 'A');
+    }
+#endif
+    return key;
+}
+}
+
 Pipeline::Pipeline() = default;
 Pipeline::~Pipeline() { stop(); }
 
 bool Pipeline::initialize(const DecoderOptions& decOpt, const PipelineConfig& config, std::string& err)
 {
     config_ = config;
+    serving_ = config.network.port > 0;
+    presenting_ = !config.exportEnabled && config.cacheOut.empty() && !serving_;
     renderer_.configure(config.renderer);
+    // Only the terminal sends the renderer's byte stream as is.
+    outputs_.terminalString = presenting_;
+    asciiQueue_.configure(config.asciiQueueDepth, config.asciiQueuePolicy);
 
-    if (!decoder_.open(decOpt, err)) {
-        return false;
+    if (!config.cacheIn.empty()) {
+        // Cached frames are already rendered; the decoder stays closed.
+        if (!cacheReader_.open(config.cacheIn, err)) {
+            return false;
+        }
+        config_.audio.enabled = false;
+    } else {
+        if (!decoder_.open(decOpt, err)) {
+            return false;
+        }
+        updateDecoderTarget();
     }
 
-    if (!config.exportEnabled) {
-        if (!terminal_.initialize()) {
+    if (presenting_) {
+        if (!terminal_.initialize(config.terminal)) {
             err = "Failed to initialize terminal";
             return false;
         }
+        fitToWindow();
     }
 
     if (config.exportEnabled) {
-        if (!exporter_.open(config.exporter, err)) {
+        config_.exporter.audioParams = decoder_.audioParameters();
+        config_.exporter.audioTimeBase = decoder_.audioTimeBase();
+        config_.exporter.startTime = decoder_.playbackStart();
+        if (!exporter_.open(config_.exporter, err)) {
+            return false;
+        }
+    }
+
+    if (!config.cacheOut.empty()) {
+        if (!cacheWriter_.open(config.cacheOut, err)) {
             return false;
         }
     }
 
-    if (config.audio.enabled) {
-        if (!audio_.start(48000, 2, config.audio, err)) {
+    if (!config.metricsOut.empty()) {
+        if (!metrics_.open(config.metricsOut, err)) {
+            return false;
+        }
+    }
+
+    if (serving_) {
+        if (!networkSink_.start(config.network, err)) {
+            return false;
+        }
+        std::cout << "Serving on " << config.network.address << ":" << config.network.port << std::endl;
+    }
+
+    if (config.batch) {
+        config_.audio.enabled = false;
+    } else if (config_.audio.enabled) {
+        if (!audio_.start(48000, 2, config_.audio, err)) {
             std::cerr << "Audio disabled: " << err << std::endl;
             config_.audio.enabled = false;
         }
+        audio_.flush(decoder_.playbackStart());
     }
+    position_.store(decoder_.playbackStart());
 
     return true;
 }
@@ -54,20 +151,22 @@ void Pipeline::run()
 {
     running_.store(true);
     startTime_ = std::chrono::steady_clock::now();
-    decoder_.start();
-    decodeWorker_ = std::thread(&Pipeline::decodeThread, this);
+    lastStats_ = startTime_;
+    if (config_.cacheIn.empty()) {
+        decoder_.start();
+        audioWorker_ = std::thread(&Pipeline::audioThread, this);
+    }
     asciiWorker_ = std::thread(&Pipeline::asciiThread, this);
     renderWorker_ = std::thread(&Pipeline::renderThread, this);
-    audioWorker_ = std::thread(&Pipeline::audioThread, this);
-    controlWorker_ = std::thread(&Pipeline::controlThread, this);
+    // A server has no keyboard; it runs until the input ends.
+    if (!config_.batch && !serving_) {
+        controlWorker_ = std::thread(&Pipeline::controlThread, this);
+    }
 
-    decodeWorker_.join();
     asciiWorker_.join();
     renderWorker_.join();
-    audioWorker_.join();
+    if (audioWorker_.joinable()) audioWorker_.join();
     running_.store(false);
-    videoCv_.notify_all();
-    asciiCv_.notify_all();
     if (controlWorker_.joinable()) controlWorker_.join();
 }
 
@@ -75,76 +174,104 @@ void Pipeline::stop()
 {
     running_.store(false);
     decoder_.stop();
-    videoCv_.notify_all();
-    asciiCv_.notify_all();
-    if (decodeWorker_.joinable()) decodeWorker_.join();
+    asciiQueue_.close();
     if (asciiWorker_.joinable()) asciiWorker_.join();
     if (renderWorker_.joinable()) renderWorker_.join();
     if (audioWorker_.joinable()) audioWorker_.join();
     if (controlWorker_.joinable()) controlWorker_.join();
     terminal_.teardown();
+    networkSink_.stop();
     audio_.stop();
     exporter_.close();
+    std::string err;
+    if (!cacheWriter_.close(err)) {
+        std::cerr << "Cache error: " << err << std::endl;
+    }
 }
 
-void Pipeline::decodeThread()
+void Pipeline::asciiThread()
 {
+    if (!config_.cacheIn.empty()) {
+        AsciiFrame frame;
+        while (running_ && cacheReader_.next(frame, outputs_)) {
+            if (!asciiQueue_.push(std::move(frame))) break;
+            frame = AsciiFrame{};
+        }
+        asciiQueue_.close();
+        return;
+    }
+
+    // Early dropping only makes sense when frames are paced by the audio clock.
+    bool paceByAudio = presenting_ && config_.audio.enabled && config_.targetFps <= 0.0 && !config_.lowLatency;
+    int lateStreak = 0;
+    int onTimeStreak = 0;
     while (running_) {
         VideoFrame frame;
         if (!decoder_.popVideoFrame(frame)) {
             break;
         }
-        {
-            std::lock_guard<std::mutex> lock(videoMutex_);
-            videoQueue_.push(std::move(frame));
+        if (frame.serial != decoder_.serial()) {
+            continue; // decoded before a seek
         }
-        videoCv_.notify_one();
-    }
-    videoCv_.notify_all();
-}
-
-void Pipeline::asciiThread()
-{
-    while (running_) {
-        VideoFrame frame;
-        {
-            std::unique_lock<std::mutex> lock(videoMutex_);
-            videoCv_.wait(lock, [&] { return !videoQueue_.empty() || !running_; });
-            if (!running_ && videoQueue_.empty()) break;
-            frame = std::move(videoQueue_.front());
-            videoQueue_.pop();
+        // While paused the clock keeps running; let backpressure hold the decoder instead.
+        if (paceByAudio && !paused_.load()) {
+            bool late = frame.pts - audio_.playbackTime() < -kLateFrameSeconds;
+            lateStreak = late ? lateStreak + 1 : 0;
+            onTimeStreak = late ? 0 : onTimeStreak + 1;
+            if (lateStreak >= kSkipEnterStreak) {
+                decoder_.setSkipNonReference(true);
+            } else if (onTimeStreak >= kSkipLeaveStreak) {
+                decoder_.setSkipNonReference(false);
+            }
+            if (late) {
+                ++droppedFrames_;
+                continue;
+            }
         }
-        AsciiFrame ascii = renderer_.render(frame);
-        {
-            std::lock_guard<std::mutex> lock(asciiMutex_);
-            asciiQueue_.push(std::move(ascii));
+        auto renderStart = std::chrono::steady_clock::now();
+        AsciiFrame ascii = renderer_.render(frame, outputs_);
+        renderTimes_.record(std::chrono::steady_clock::now() - renderStart);
+        if (!asciiQueue_.push(std::move(ascii))) {
+            break;
         }
-        asciiCv_.notify_one();
     }
-    asciiCv_.notify_all();
+    asciiQueue_.close();
 }
 
 void Pipeline::renderThread()
 {
+    // Without audio the wall clock is anchored to the first frame's pts, and
+    // again after every seek.
     auto clockStart = std::chrono::steady_clock::now();
+    bool rebase = true;
+    uint64_t serial = 0;
+    double lastPts = 0.0;
     while (running_) {
         AsciiFrame frame;
-        {
-            std::unique_lock<std::mutex> lock(asciiMutex_);
-            asciiCv_.wait(lock, [&] { return !asciiQueue_.empty() || !running_; });
-            if (!running_ && asciiQueue_.empty()) break;
-            frame = std::move(asciiQueue_.front());
-            asciiQueue_.pop();
+        if (!asciiQueue_.pop(frame)) {
+            break;
         }
 
         while (paused_.load() && running_) {
             std::this_thread::sleep_for(std::chrono::milliseconds(20));
         }
         if (!running_) break;
+        if (frame.serial != decoder_.serial()) {
+            continue;
+        }
+        if (frame.serial != serial) {
+            serial = frame.serial;
+            rebase = true;
+        }
 
-        if (config_.exportEnabled) {
+        if (!presenting_ && !serving_) {
             std::string err;
-            if (!exporter_.writeFrame(frame, err)) {
+            if (cacheWriter_.isOpen() && !cacheWriter_.write(frame, err)) {
+                std::cerr << "Cache error: " << err << std::endl;
+            }
+            // The exporter is the last reader of the cells, so it takes them
+            // over; pts stays valid for the bookkeeping below.
+            if (config_.exportEnabled && !exporter_.writeFrame(std::move(frame), err)) {
                 std::cerr << "Export error: " << err << std::endl;
             }
         } else {
@@ -152,36 +279,79 @@ void Pipeline::renderThread()
             if (config_.targetFps > 0.0) {
                 target = renderedFrames_ / config_.targetFps;
             }
-            if (config_.audio.enabled) {
+            if (config_.lowLatency) {
+                // A live source is its own clock; waiting only adds delay.
+            } else if (config_.audio.enabled) {
                 double audioClock = audio_.playbackTime();
                 double diff = target - audioClock;
                 if (diff > 0.01) {
                     std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int>(diff * 1000)));
-                } else if (diff < -0.05) {
+                } else if (diff < -kLateFrameSeconds) {
                     ++droppedFrames_;
                     continue;
                 }
             } else {
                 auto now = std::chrono::steady_clock::now();
+                if (rebase) {
+                    clockStart = now - std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                        std::chrono::duration<double>(target));
+                    rebase = false;
+                }
                 double elapsed = std::chrono::duration<double>(now - clockStart).count();
                 double diff = target - elapsed;
                 if (diff > 0) std::this_thread::sleep_for(std::chrono::duration<double>(diff));
             }
 
-            terminal_.present(frame);
+            if (config_.audio.enabled) {
+                haveDrift_ = true;
+                avDriftMs_ = (frame.pts - audio_.playbackTime()) * 1000.0;
+            }
+            if (presenting_) {
+                terminal_.present(frame);
+                if (terminal_.writeFailed()) {
+                    std::cerr << "Terminal write failed, stopping" << std::endl;
+                    running_.store(false);
+                    decoder_.stop();
+                    asciiQueue_.close();
+                    break;
+                }
+            }
+            if (serving_) networkSink_.broadcast(frame);
         }
         ++renderedFrames_;
+        lastPts = frame.pts;
+        position_.store(frame.pts);
         updateStats(frame);
     }
+    if (config_.batch) {
+        reportProgress(lastPts, true);
+    }
 }
 
 void Pipeline::audioThread()
 {
+    if (config_.exportEnabled) {
+        // Exports take the compressed packets straight into the output file.
+        // After a failure keep draining so the decoder never blocks on audio.
+        PacketPtr packet;
+        bool writing = true;
+        while (running_ && decoder_.popAudioPacket(packet)) {
+            std::string err;
+            if (writing && !exporter_.writeAudioPacket(packet.get(), err)) {
+                std::cerr << "Export error: " << err << std::endl;
+                writing = false;
+            }
+        }
+        return;
+    }
     while (running_) {
         AudioFrame frame;
         if (!decoder_.popAudioFrame(frame)) {
             break;
         }
+        if (frame.serial != decoder_.serial()) {
+            continue;
+        }
         audio_.enqueue(frame);
     }
 }
@@ -189,16 +359,13 @@ void Pipeline::audioThread()
 void Pipeline::controlThread()
 {
     while (running_) {
-        int key = -1;
-#ifdef _WIN32
-        if (_kbhit()) {
-            key = _getch();
+        // Rendering keeps going at the old size until the new config lands.
+        if (terminal_.takeResize()) {
+            fitToWindow();
+            terminal_.invalidate();
         }
-#else
-        unsigned char c = 0;
-        ssize_t n = ::read(STDIN_FILENO, &c, 1);
-        if (n > 0) key = c;
-#endif
+        // A stdin carrying the input stream is no keyboard.
+        int key = config_.terminal.keyboard ? read_key() : -1;
         if (key < 0) {
             std::this_thread::sleep_for(std::chrono::milliseconds(30));
             continue;
@@ -207,16 +374,16 @@ void Pipeline::controlThread()
             bool newState = !paused_.load();
             paused_.store(newState);
             if (config_.audio.enabled) {
-                audio_.setVolume(newState ? 0.0f : config_.audio.volume);
+                audio_.setMuted(newState);
             }
         } else if (key == 'q' || key == 'Q') {
             running_.store(false);
             decoder_.stop();
-            videoCv_.notify_all();
-            asciiCv_.notify_all();
+            asciiQueue_.close();
             break;
         } else if (key == 'c' || key == 'C') {
             renderer_.cycleMode();
+            updateDecoderTarget();
         } else if (key == 'd' || key == 'D') {
             renderer_.cycleDither();
         } else if (key == 'g') {
@@ -231,38 +398,242 @@ void Pipeline::controlThread()
             auto cfg = renderer_.config();
             cfg.mode = RenderMode::Gray;
             renderer_.configure(cfg);
+            updateDecoderTarget();
         } else if (key == '2') {
             auto cfg = renderer_.config();
             cfg.mode = RenderMode::ANSI256;
             renderer_.configure(cfg);
+            updateDecoderTarget();
         } else if (key == '3') {
             auto cfg = renderer_.config();
             cfg.mode = RenderMode::TrueColor;
             renderer_.configure(cfg);
+            updateDecoderTarget();
         } else if (key == 'r' || key == 'R') {
-            auto cfg = renderer_.config();
-            renderer_.configure(cfg);
+            terminal_.requestResize();
+        } else if (key == kKeyLeft) {
+            seekBy(-kSeekShortSeconds);
+        } else if (key == kKeyRight) {
+            seekBy(kSeekShortSeconds);
+        } else if (key == kKeyDown) {
+            seekBy(-kSeekLongSeconds);
+        } else if (key == kKeyUp) {
+            seekBy(kSeekLongSeconds);
         }
     }
 }
 
+void Pipeline::seekBy(double seconds)
+{
+    // Exports and caches are written in one pass; a cache plays as stored.
+    if (!presenting_ || !config_.cacheIn.empty()) return;
+    double target = std::max(decoder_.playbackStart(), position_.load() + seconds);
+    decoder_.seek(target);
+    asciiQueue_.clear();
+    if (config_.audio.enabled) {
+        audio_.flush(target);
+    }
+    position_.store(target);
+}
+
+void Pipeline::updateDecoderTarget()
+{
+    RendererConfig cfg = renderer_.config();
+    // Gray mode only needs luma, so skip the RGB conversion entirely.
+    decoder_.setOutputFormat(cfg.mode == RenderMode::Gray ? AV_PIX_FMT_GRAY8 : AV_PIX_FMT_RGB24);
+    if (config_.decodeScale <= 0) {
+        decoder_.setOutputSize(0, 0);
+        return;
+    }
+    int rows = cfg.halfBlock ? cfg.gridRows * 2 : cfg.gridRows;
+    decoder_.setOutputSize(cfg.gridCols * config_.decodeScale, rows * config_.decodeScale);
+}
+
+// An explicit grid is kept while it fits and scaled down, aspect intact,
+// when it does not; cells past the window edge would only wrap.
+void Pipeline::fitToWindow()
+{
+    // A cached clip keeps the grid it was rendered at.
+    if (!config_.cacheIn.empty()) return;
+    int windowCols = 0;
+    int windowRows = 0;
+    if (!terminal_.windowSize(windowCols, windowRows)) return;
+    // Every row ends in a newline, so a full-height frame would scroll.
+    windowRows = std::max(1, windowRows - 1);
+
+    int cols = config_.renderer.gridCols;
+    int rows = config_.renderer.gridRows;
+    if (config_.autoGrid) {
+        double aspect = decoder_.sourceHeight() > 0
+            ? static_cast<double>(decoder_.sourceWidth()) / decoder_.sourceHeight()
+            : 16.0 / 9.0;
+        cols = windowCols;
+        rows = static_cast<int>(std::lround(cols / (aspect * kCellAspect)));
+        if (rows > windowRows) {
+            rows = windowRows;
+            cols = std::min(windowCols, static_cast<int>(std::lround(rows * aspect * kCellAspect)));
+        }
+    } else {
+        double scale = std::min({1.0, static_cast<double>(windowCols) / cols,
+                                 static_cast<double>(windowRows) / rows});
+        cols = static_cast<int>(cols * scale);
+        rows = static_cast<int>(rows * scale);
+    }
+    cols = std::max(1, cols);
+    rows = std::max(1, rows);
+
+    RendererConfig cfg = renderer_.config();
+    if (cfg.gridCols == cols && cfg.gridRows == rows) return;
+    cfg.gridCols = cols;
+    cfg.gridRows = rows;
+    renderer_.configure(cfg);
+    updateDecoderTarget();
+}
+
 void Pipeline::updateStats(const AsciiFrame& frame)
 {
-    if (!config_.showStats) return;
-    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime_).count();
-    double fps = elapsed > 0 ? renderedFrames_ / elapsed : 0.0;
+    if (config_.batch) {
+        reportProgress(frame.pts, false);
+    }
+    bool overlay = config_.showStats && !config_.batch;
+    if (!overlay && !metrics_.isOpen()) return;
+    // Sampling every stage and redrawing the overlay is kept off the per
+    // frame path.
+    auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<double>(now - lastStats_).count() < kStatsIntervalSeconds) return;
+    MetricsSample sample = collectMetrics(now);
+    metrics_.write(sample);
+    if (overlay) {
+        showStats(sample);
+    }
+}
+
+MetricsSample Pipeline::collectMetrics(std::chrono::steady_clock::time_point now)
+{
+    double interval = std::chrono::duration<double>(now - lastStats_).count();
+    lastStats_ = now;
+
+    MetricsSample sample;
+    sample.elapsed = std::chrono::duration<double>(now - startTime_).count();
+    sample.fps = interval > 0 ? (renderedFrames_ - lastStatsRendered_) / interval : 0.0;
+    lastStatsRendered_ = renderedFrames_;
+    sample.rendered = renderedFrames_;
+    sample.dropped = droppedFrames_ + decoder_.failedDownloads();
+
+    const LatencyHistogram* histograms[kStageCount] = {
+        &decoder_.decodeTimes(), &decoder_.scaleTimes(), &renderTimes_,
+        &terminal_.encodeTimes(), &terminal_.presentTimes(),
+        &exporter_.rasterTimes(), &exporter_.encodeTimes(),
+    };
+    for (size_t i = 0; i < kStageCount; ++i) {
+        LatencyHistogram::Snapshot counts = histograms[i]->snapshot();
+        sample.stages[i] = summarize(counts, lastStageCounts_[i]);
+        lastStageCounts_[i] = counts;
+    }
+
+    sample.queues.push_back({"video", decoder_.videoQueueStats()});
+    sample.queues.push_back({"audio", decoder_.audioQueueStats()});
+    sample.queues.push_back({"ascii", asciiQueue_.stats()});
+    if (config_.exportEnabled) {
+        sample.queues.push_back({"raster", exporter_.rasterQueueStats()});
+        sample.queues.push_back({"encode", exporter_.encodeQueueStats()});
+        sample.queues.push_back({"mux", exporter_.muxQueueStats()});
+    }
+
+    uint64_t bytes = terminal_.bytesWritten() + networkSink_.bytesSent() + exporter_.bytesWritten();
+    sample.bytesPerSecond = interval > 0 ? (bytes - lastStatsBytes_) / interval : 0.0;
+    lastStatsBytes_ = bytes;
+    sample.haveDrift = haveDrift_;
+    sample.avDriftMs = avDriftMs_;
+    return sample;
+}
+
+void Pipeline::showStats(const MetricsSample& sample)
+{
     std::ostringstream oss;
     oss << std::fixed << std::setprecision(1)
-        << "FPS: " << fps << " Rendered: " << renderedFrames_ << " Dropped: " << droppedFrames_;
+        << "FPS: " << sample.fps << " Rendered: " << sample.rendered << " Dropped: " << sample.dropped;
+    if (config_.audio.enabled) {
+        oss << " Underruns: " << audio_.underruns();
+    }
+    oss << " Queue:";
+    uint64_t evicted = 0;
+    for (const auto& queue : sample.queues) {
+        oss << " " << queue.first << " " << queue.second.depth << "/" << queue.second.capacity;
+        evicted += queue.second.dropped;
+    }
+    if (evicted > 0) {
+        oss << " Evicted: " << evicted;
+    }
+    if (decoder_.skippingNonReference()) {
+        oss << " [Skipping non-ref]";
+    }
+    if (presenting_) {
+        if (terminal_.degradeLevel() != OutputDegrade::None) {
+            oss << " Output: " << terminal_.degradeLabel();
+        }
+        if (terminal_.skippedFrames() > 0) {
+            oss << " Skipped: " << terminal_.skippedFrames();
+        }
+    }
+    if (serving_) {
+        oss << " Clients: " << networkSink_.clientCount();
+        if (networkSink_.droppedFrames() > 0) {
+            oss << " NetDropped: " << networkSink_.droppedFrames();
+        }
+    }
     if (paused_.load()) {
         oss << " [Paused]";
     }
-    statsLine_ = oss.str();
-    if (!config_.exportEnabled) {
+
+    // Second line: p50/p99 per stage over the last interval, in ms.
+    std::ostringstream timing;
+    timing << std::fixed << std::setprecision(2) << "p50/p99 ms:";
+    for (size_t i = 0; i < kStageCount; ++i) {
+        const LatencySummary& stage = sample.stages[i];
+        if (stage.count == 0) continue;
+        timing << " " << stage_name(static_cast<Stage>(i)) << " " << stage.p50Ms << "/" << stage.p99Ms;
+    }
+    timing << std::setprecision(1) << " Out: " << sample.bytesPerSecond / 1e6 << " MB/s";
+    if (sample.haveDrift) {
+        timing << " A/V: " << std::showpos << sample.avDriftMs << std::noshowpos << " ms";
+    }
+
+    if (presenting_) {
+        statsLine_ = oss.str() + "\n" + timing.str();
         terminal_.printStats(statsLine_);
     } else {
-        std::cout << "[Export] " << statsLine_ << "\r";
+        statsLine_ = oss.str() + " | " + timing.str();
+        std::cout << (serving_ ? "[Serve] " : "[Export] ") << statsLine_ << "\r";
     }
 }
 
+// One key=value line per report so wrapper scripts can parse it; the last
+// line of a run carries progress=end.
+void Pipeline::reportProgress(double pts, bool done)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (!done && std::chrono::duration<double>(now - lastProgress_).count() < kProgressIntervalSeconds) {
+        return;
+    }
+    lastProgress_ = now;
+    double elapsed = std::chrono::duration<double>(now - startTime_).count();
+    double fps = elapsed > 0 ? renderedFrames_ / elapsed : 0.0;
+    if (config_.cacheIn.empty()) {
+        pts -= decoder_.playbackStart();
+    }
+    double speed = elapsed > 0 ? pts / elapsed : 0.0;
+    double duration = config_.cacheIn.empty() ? decoder_.playbackDuration() : cacheReader_.duration();
+    double eta = done ? 0.0 : -1.0;
+    if (!done && duration > 0 && speed > 0) {
+        eta = std::max(0.0, duration - pts) / speed;
+    }
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(2)
+        << "frame=" << renderedFrames_ << " fps=" << fps << " speed=" << speed << "x"
+        << " time=" << pts << " duration=" << duration << " eta=" << eta
+        << " dropped=" << droppedFrames_ + decoder_.failedDownloads() << " progress=" << (done ? "end" : "continue") << "\n";
+    std::cout << oss.str() << std::flush;
+}
+
 } // namespace asciiplay
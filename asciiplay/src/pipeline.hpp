@@ -1,16 +1,18 @@
 #pragma once
 
+#include "ascii_cache.hpp"
 #include "ascii_renderer.hpp"
 #include "audio_player.hpp"
 #include "decoder.hpp"
 #include "terminal_sink.hpp"
 #include "exporter.hpp"
+#include "metrics.hpp"
+#include "network_sink.hpp"
+#include "stage_queue.hpp"
 
+#include <array>
 #include <atomic>
 #include <chrono>
-#include <condition_variable>
-#include <mutex>
-#include <queue>
 #include <thread>
 
 namespace asciiplay {
@@ -19,10 +21,35 @@ struct PipelineConfig {
     RendererConfig renderer;
     AudioConfig audio;
     TerminalConfig terminal;
+    // Broadcast to TCP clients instead of the local terminal when port > 0.
+    NetworkConfig network;
     bool exportEnabled = false;
+    // Also write rendered frames to this .asciicache file; like export, this
+    // runs without a terminal.
+    std::string cacheOut;
+    // Play this .asciicache file instead of decoding and rendering.
+    std::string cacheIn;
+    // Headless export: no terminal, audio device or key handling, and frames
+    // are encoded as fast as they can be rendered.
+    bool batch = false;
     ExportConfig exporter;
     double targetFps = 0.0;
+    // Fill the terminal window at the source aspect ratio instead of using
+    // renderer.gridCols x gridRows, which otherwise only shrink to fit.
+    bool autoGrid = false;
     bool showStats = false;
+    // Append a MetricsSample here every stats interval: JSON lines when the
+    // name ends in .json, CSV otherwise.
+    std::string metricsOut;
+    // Decoder output pixels per cell edge; 0 keeps the source resolution.
+    int decodeScale = 2;
+    // Rendered frames waiting for the terminal or exporter.
+    size_t asciiQueueDepth = 4;
+    QueuePolicy asciiQueuePolicy = QueuePolicy::Block;
+    // Live monitoring: show each frame as soon as it is rendered instead of
+    // pacing it by pts or the audio clock. Pair with depth-1 drop-oldest
+    // queues so only the newest frame is ever waiting.
+    bool lowLatency = false;
 };
 
 class Pipeline {
@@ -35,41 +62,58 @@ public:
     void stop();
 
 private:
-    void decodeThread();
     void renderThread();
     void asciiThread();
     void audioThread();
     void controlThread();
     void updateStats(const AsciiFrame& frame);
+    MetricsSample collectMetrics(std::chrono::steady_clock::time_point now);
+    void showStats(const MetricsSample& sample);
+    void reportProgress(double pts, bool done);
+    // Relative seek from the last presented frame; playback only.
+    void seekBy(double seconds);
+    void updateDecoderTarget();
+    void fitToWindow();
 
     Decoder decoder_;
     AsciiRenderer renderer_;
     TerminalSink terminal_;
     AudioPlayer audio_;
     Exporter exporter_;
+    AsciiCacheWriter cacheWriter_;
+    AsciiCacheReader cacheReader_;
+    NetworkSink networkSink_;
 
     PipelineConfig config_;
+    bool presenting_ = true; // frames go to the terminal
+    bool serving_ = false;   // frames go to network clients, paced like playback
+    RenderOutputs outputs_;  // what the sinks above read from each frame
 
     std::atomic<bool> running_{false};
     std::atomic<bool> paused_{false};
-    std::thread decodeWorker_;
+    std::atomic<double> position_{0.0}; // pts of the last presented frame
     std::thread renderWorker_;
     std::thread asciiWorker_;
     std::thread audioWorker_;
     std::thread controlWorker_;
 
-    std::mutex videoMutex_;
-    std::condition_variable videoCv_;
-    std::queue<VideoFrame> videoQueue_;
-
-    std::mutex asciiMutex_;
-    std::condition_variable asciiCv_;
-    std::queue<AsciiFrame> asciiQueue_;
+    StageQueue<AsciiFrame> asciiQueue_;
 
     std::string statsLine_;
     std::chrono::steady_clock::time_point startTime_;
     uint64_t renderedFrames_ = 0;
-    uint64_t droppedFrames_ = 0;
+
+    // Stats and metrics state, render thread only except renderTimes_.
+    LatencyHistogram renderTimes_;
+    MetricsWriter metrics_;
+    std::array<LatencyHistogram::Snapshot, kStageCount> lastStageCounts_{};
+    std::chrono::steady_clock::time_point lastStats_;
+    uint64_t lastStatsRendered_ = 0;
+    uint64_t lastStatsBytes_ = 0;
+    bool haveDrift_ = false;
+    double avDriftMs_ = 0.0;
+    std::chrono::steady_clock::time_point lastProgress_;
+    std::atomic<uint64_t> droppedFrames_{0};
 };
 
 } // namespace asciiplay
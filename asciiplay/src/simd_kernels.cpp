@@ -0,0 +1,141 @@
+#include "simd_kernels.hpp"
+
+#include <cstring>
+
+#if defined(ASCIIPLAY_ENABLE_SIMD) && (defined(__x86_64__) || defined(_M_X64))
+#define ASCIIPLAY_SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define ASCIIPLAY_TARGET_AVX2
+#else
+#define ASCIIPLAY_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(ASCIIPLAY_ENABLE_SIMD) && (defined(__aarch64__) || defined(_M_ARM64))
+#define ASCIIPLAY_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace asciiplay {
+
+namespace {
+
+void column_sums_scalar(const uint8_t* src, size_t stride, int rows, int bytes, uint16_t* sums)
+{
+    std::memset(sums, 0, sizeof(uint16_t) * bytes);
+    for (int r = 0; r < rows; ++r) {
+        const uint8_t* line = src + r * stride;
+        for (int i = 0; i < bytes; ++i) sums[i] = static_cast<uint16_t>(sums[i] + line[i]);
+    }
+}
+
+// Finishes the columns a vector kernel left over.
+void column_sums_tail(const uint8_t* src, size_t stride, int rows, int begin, int bytes, uint16_t* sums)
+{
+    if (begin < bytes) column_sums_scalar(src + begin, stride, rows, bytes - begin, sums + begin);
+}
+
+#ifdef ASCIIPLAY_SIMD_X86
+// SSE2 is part of x86-64, so this one needs no feature check.
+void column_sums_sse2(const uint8_t* src, size_t stride, int rows, int bytes, uint16_t* sums)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i lo = zero;
+        __m128i hi = zero;
+        const uint8_t* p = src + i;
+        for (int r = 0; r < rows; ++r, p += stride) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+            hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sums + i), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sums + i + 8), hi);
+    }
+    column_sums_tail(src, stride, rows, i, bytes, sums);
+}
+
+ASCIIPLAY_TARGET_AVX2
+void column_sums_avx2(const uint8_t* src, size_t stride, int rows, int bytes, uint16_t* sums)
+{
+    int i = 0;
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i lo = _mm256_setzero_si256();
+        __m256i hi = _mm256_setzero_si256();
+        const uint8_t* p = src + i;
+        for (int r = 0; r < rows; ++r, p += stride) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+            lo = _mm256_add_epi16(lo, _mm256_cvtepu8_epi16(a));
+            hi = _mm256_add_epi16(hi, _mm256_cvtepu8_epi16(b));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums + i), lo);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums + i + 16), hi);
+    }
+    column_sums_sse2(src + i, stride, rows, bytes - i, sums + i);
+}
+
+bool cpu_has_avx2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 0x6) != 0x6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+#ifdef ASCIIPLAY_SIMD_NEON
+void column_sums_neon(const uint8_t* src, size_t stride, int rows, int bytes, uint16_t* sums)
+{
+    int i = 0;
+    for (; i + 16 <= bytes; i += 16) {
+        uint16x8_t lo = vdupq_n_u16(0);
+        uint16x8_t hi = vdupq_n_u16(0);
+        const uint8_t* p = src + i;
+        for (int r = 0; r < rows; ++r, p += stride) {
+            uint8x16_t v = vld1q_u8(p);
+            lo = vaddw_u8(lo, vget_low_u8(v));
+            hi = vaddw_u8(hi, vget_high_u8(v));
+        }
+        vst1q_u16(sums + i, lo);
+        vst1q_u16(sums + i + 8, hi);
+    }
+    column_sums_tail(src, stride, rows, i, bytes, sums);
+}
+#endif
+
+SimdKernels select_kernels()
+{
+#if defined(ASCIIPLAY_SIMD_X86)
+    if (cpu_has_avx2()) return SimdKernels{"avx2", &column_sums_avx2};
+    return SimdKernels{"sse2", &column_sums_sse2};
+#elif defined(ASCIIPLAY_SIMD_NEON)
+    return SimdKernels{"neon", &column_sums_neon};
+#else
+    return scalar_kernels();
+#endif
+}
+
+} // namespace
+
+const SimdKernels& scalar_kernels()
+{
+    static const SimdKernels kernels{"scalar", &column_sums_scalar};
+    return kernels;
+}
+
+const SimdKernels& simd_kernels()
+{
+    static const SimdKernels kernels = select_kernels();
+    return kernels;
+}
+
+} // namespace asciiplay
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace asciiplay {
+
+// Tallest block column_sums() accepts: 257 * 255 still fits in 16 bits.
+constexpr int kMaxColumnRows = 257;
+
+// sums[i] = sum of src[r * stride + i] for r in [0, rows), for every i < bytes.
+// Works for any interleaving, so RGB24 and luma rows share it.
+using ColumnSumsFn = void (*)(const uint8_t* src, size_t stride, int rows, int bytes, uint16_t* sums);
+
+struct SimdKernels {
+    const char* name;
+    ColumnSumsFn columnSums;
+};
+
+// Portable reference; every vector kernel must match it bit for bit.
+const SimdKernels& scalar_kernels();
+// Best kernels for the running CPU, chosen once on first use.
+const SimdKernels& simd_kernels();
+
+} // namespace asciiplay
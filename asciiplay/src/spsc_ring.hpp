@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace asciiplay {
+
+// Wait-free single-producer/single-consumer ring. One thread may call
+// write() and another read(); neither ever blocks, locks or allocates,
+// which makes the consumer side safe for real-time audio callbacks.
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        buffer_.resize(size);
+        mask_ = size - 1;
+    }
+
+    size_t capacity() const { return buffer_.size(); }
+
+    size_t size() const
+    {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+    // Total elements ever written; a position to hand to discardTo().
+    size_t writePosition() const { return head_.load(std::memory_order_acquire); }
+
+    // Producer: copies up to `count` elements, returns how many fit.
+    size_t write(const T* data, size_t count)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        size_t n = std::min(count, capacity() - (head - tail));
+        size_t first = std::min(n, capacity() - (head & mask_));
+        std::copy(data, data + first, buffer_.data() + (head & mask_));
+        std::copy(data + first, data + n, buffer_.data());
+        head_.store(head + n, std::memory_order_release);
+        return n;
+    }
+
+    // Consumer: copies up to `count` elements out, returns how many were read.
+    size_t read(T* out, size_t count)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_acquire);
+        size_t n = std::min(count, head - tail);
+        size_t first = std::min(n, capacity() - (tail & mask_));
+        std::copy(buffer_.data() + (tail & mask_), buffer_.data() + (tail & mask_) + first, out);
+        std::copy(buffer_.data(), buffer_.data() + (n - first), out + first);
+        tail_.store(tail + n, std::memory_order_release);
+        return n;
+    }
+
+    // Consumer: skips everything before `position` without copying it out.
+    void discardTo(size_t position)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_acquire);
+        if (static_cast<std::ptrdiff_t>(position - tail) <= 0) return;
+        tail_.store(tail + std::min(position - tail, head - tail), std::memory_order_release);
+    }
+
+private:
+    std::vector<T> buffer_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+} // namespace asciiplay
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+namespace asciiplay {
+
+// What push() does when a stage queue is full.
+enum class QueuePolicy {
+    Block,     // wait for the consumer (backpressure)
+    DropOldest // discard the oldest queued item to make room
+};
+
+struct QueueStats {
+    size_t depth = 0;
+    size_t capacity = 0;
+    uint64_t dropped = 0;
+};
+
+// Bounded hand-off between two pipeline stages. close() wakes everyone:
+// further pushes fail and pop() drains what is left before returning false.
+template <typename T>
+class StageQueue {
+public:
+    explicit StageQueue(size_t capacity = 1, QueuePolicy policy = QueuePolicy::Block)
+        : capacity_(capacity > 0 ? capacity : 1)
+        , policy_(policy)
+    {
+    }
+
+    // Must be called before either side starts using the queue.
+    void configure(size_t capacity, QueuePolicy policy)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        capacity_ = capacity > 0 ? capacity : 1;
+        policy_ = policy;
+    }
+
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (policy_ == QueuePolicy::Block) {
+            notFull_.wait(lock, [&] { return items_.size() < capacity_ || closed_; });
+        } else {
+            while (items_.size() >= capacity_) {
+                items_.pop_front();
+                ++dropped_;
+            }
+        }
+        if (closed_) return false;
+        items_.push_back(std::move(item));
+        lock.unlock();
+        notEmpty_.notify_one();
+        return true;
+    }
+
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [&] { return !items_.empty() || closed_; });
+        if (items_.empty()) return false;
+        item = std::move(items_.front());
+        items_.pop_front();
+        lock.unlock();
+        notFull_.notify_one();
+        return true;
+    }
+
+    // Discards everything queued (a seek made it stale); producers waiting
+    // on a full queue resume. Not counted as dropped.
+    void clear()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            items_.clear();
+        }
+        notFull_.notify_all();
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        notEmpty_.notify_all();
+        notFull_.notify_all();
+    }
+
+    QueueStats stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return QueueStats{items_.size(), capacity_, dropped_};
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notFull_;
+    std::deque<T> items_;
+    size_t capacity_;
+    QueuePolicy policy_;
+    uint64_t dropped_ = 0;
+    bool closed_ = false;
+};
+
+} // namespace asciiplay
@@ -1,17 +1,111 @@
 #include "terminal_sink.hpp"
+#include "ansi_encoder.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <csignal>
 #include <cstdio>
 #include <iostream>
 #ifdef _WIN32
 #else
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #endif
 
 namespace asciiplay {
 
+namespace {
+// Burst allowance of the write budget, in seconds of output.
+constexpr double kBucketSeconds = 0.25;
+// A write stalling longer than this is taken as terminal backpressure.
+constexpr double kBlockedWriteSeconds = 0.002;
+// Time the budget must stay unused before stepping back up one stage.
+constexpr double kRecoverSeconds = 1.0;
+
+using Clock = std::chrono::steady_clock;
+
+#ifndef _WIN32
+volatile std::sig_atomic_t gWindowChanged = 0;
+
+void handleWindowChange(int)
+{
+    gWindowChanged = 1;
+}
+#endif
+
+double seconds_between(Clock::time_point a, Clock::time_point b)
+{
+    return std::chrono::duration<double>(b - a).count();
+}
+
+struct OutputChunk {
+    const char* data;
+    size_t size;
+};
+
+// Writes every chunk to stdout with as few syscalls as possible, bypassing
+// iostreams. Partial writes are resumed, and a non-blocking stdout (it
+// shares the tty with stdin, which raw mode makes non-blocking) is waited on.
+bool write_stdout(OutputChunk* chunks, int count)
+{
+#ifdef _WIN32
+    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (hOut == INVALID_HANDLE_VALUE) return false;
+    for (int i = 0; i < count; ++i) {
+        const char* data = chunks[i].data;
+        size_t remaining = chunks[i].size;
+        while (remaining > 0) {
+            DWORD written = 0;
+            DWORD request = static_cast<DWORD>(std::min<size_t>(remaining, 1u << 30));
+            if (!WriteFile(hOut, data, request, &written, nullptr) || written == 0) return false;
+            data += written;
+            remaining -= written;
+        }
+    }
+    return true;
+#else
+    constexpr int kMaxChunks = 4;
+    iovec iov[kMaxChunks];
+    int iovCount = 0;
+    for (int i = 0; i < count && iovCount < kMaxChunks; ++i) {
+        if (chunks[i].size == 0) continue;
+        iov[iovCount].iov_base = const_cast<char*>(chunks[i].data);
+        iov[iovCount].iov_len = chunks[i].size;
+        ++iovCount;
+    }
+    iovec* cursor = iov;
+    while (iovCount > 0) {
+        ssize_t n = ::writev(STDOUT_FILENO, cursor, iovCount);
+        if (n == 0) return false;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                pollfd pfd{STDOUT_FILENO, POLLOUT, 0};
+                ::poll(&pfd, 1, -1);
+                continue;
+            }
+            return false;
+        }
+        size_t done = static_cast<size_t>(n);
+        while (iovCount > 0 && done >= cursor->iov_len) {
+            done -= cursor->iov_len;
+            ++cursor;
+            --iovCount;
+        }
+        if (iovCount > 0) {
+            cursor->iov_base = static_cast<char*>(cursor->iov_base) + done;
+            cursor->iov_len -= done;
+        }
+    }
+    return true;
+#endif
+}
+}
+
 TerminalSink::TerminalSink() = default;
 
 TerminalSink::~TerminalSink()
@@ -19,14 +113,17 @@ TerminalSink::~TerminalSink()
     teardown();
 }
 
-bool TerminalSink::initialize()
+bool TerminalSink::initialize(const TerminalConfig& cfg)
 {
     if (initialized_) return true;
+    config_ = cfg;
+    havePrevious_ = false;
     enableVirtualTerminal();
     hideCursor();
-    enableRawMode();
+    if (cfg.keyboard) enableRawMode();
     maximizeWindow();
 #ifndef _WIN32
+    std::signal(SIGWINCH, handleWindowChange);
     std::cout << "请全屏终端/最大化" << std::endl;
 #endif
     initialized_ = true;
@@ -36,6 +133,9 @@ bool TerminalSink::initialize()
 void TerminalSink::teardown()
 {
     if (!initialized_) return;
+#ifndef _WIN32
+    std::signal(SIGWINCH, SIG_DFL);
+#endif
     disableRawMode();
     showCursor();
     std::cout << "\x1b[0m" << std::flush;
@@ -133,16 +233,254 @@ void TerminalSink::disableRawMode()
 
 void TerminalSink::present(const AsciiFrame& frame)
 {
-    if (!initialized_) return;
-    std::cout << frame.terminalString;
-    std::cout.flush();
+    if (!initialized_ || writeFailed_) return;
+    auto now = Clock::now();
+    EncodeOptions options = outputOptions(frame);
+
+    // A new grid size leaves stale cells outside the new area, so wipe them.
+    bool clear = invalidated_.exchange(false);
+    if (presentedCols_ != frame.cols || presentedRows_ != frame.rows) {
+        clear = clear || presentedCols_ != 0;
+        presentedCols_ = frame.cols;
+        presentedRows_ = frame.rows;
+    }
+    if (clear) {
+        forceFull_ = true;
+        havePrevious_ = false;
+    }
+
+    const char* output = frame.terminalString.data();
+    size_t outputSize = frame.terminalString.size();
+    auto encodeStart = Clock::now();
+    bool tryDelta = config_.diffThreshold > 0.0 && !forceFull_ && havePrevious_;
+    // The renderer's dirty mask is relative to the frame it rendered last,
+    // so it only applies when that is the frame on screen.
+    const uint8_t* dirty = havePrevious_ && frame.sequence == previous_.sequence + 1
+        && frame.dirty.size() == frame.cells.size() && previous_.cells.size() == frame.cells.size()
+        ? frame.dirty.data() : nullptr;
+    bool delta = tryDelta && encode_delta(frame, previous_, options,
+                                          static_cast<size_t>(config_.diffThreshold * frame.cells.size()), deltaBuffer_,
+                                          dirty);
+    if (delta) {
+        appendRestore(frame, options);
+        output = deltaBuffer_.data();
+        outputSize = deltaBuffer_.size();
+    } else if (options.palette256 || frame.terminalString.empty()) {
+        fullBuffer_.clear();
+        char* out = fullBuffer_.reserveTail(3 + max_encoded_rows(frame.cols, frame.rows));
+        out = encode_literal("\x1b[H", out);
+        fullBuffer_.commit(encode_rows(frame, options, 0, frame.rows, out));
+        output = fullBuffer_.data();
+        outputSize = fullBuffer_.size();
+    }
+    if (tryDelta || options.palette256 || frame.terminalString.empty()) {
+        encodeTimes_.record(Clock::now() - encodeStart);
+    }
+
+    if (!admitBytes(outputSize + overlay_.size(), now)) {
+        ++skippedFrames_;
+        // Nothing was written, but a stale terminal rate must still expire.
+        recordWrite(0, 0.0, now);
+        return;
+    }
+
+    // The stats overlay rides in every frame's write: a full frame repaints
+    // the rows under it, so drawing it only after a rebuild would flicker.
+    static const char kClear[] = "\x1b[2J";
+    OutputChunk chunks[] = {
+        {kClear, clear ? sizeof(kClear) - 1 : 0},
+        {output, outputSize},
+        {overlay_.data(), overlay_.size()}
+    };
+    auto writeStart = Clock::now();
+    bool written = write_stdout(chunks, 3);
+    auto writeEnd = Clock::now();
+    if (!written) {
+        // stdout is gone (EPIPE, closed terminal); a partial frame is no
+        // sample of the terminal rate, and nothing more will get through.
+        writeFailed_ = true;
+        return;
+    }
+    presentTimes_.record(writeEnd - writeStart);
+    bytesWritten_.fetch_add(outputSize + overlay_.size(), std::memory_order_relaxed);
+    // Either the delta carried the restored cells or a full frame covered them.
+    restore_.clear();
+    recordWrite(outputSize + overlay_.size(), seconds_between(writeStart, writeEnd), writeEnd);
+
+    forceFull_ = false;
+    if (config_.diffThreshold > 0.0) {
+        rememberFrame(frame, dirty);
+    }
+}
+
+const char* TerminalSink::degradeLabel() const
+{
+    switch (degrade_) {
+    case OutputDegrade::Palette256:
+        return "256-colour";
+    case OutputDegrade::CoarseRuns:
+        return "coarse colour";
+    case OutputDegrade::SkipFrames:
+        return "skipping frames";
+    default:
+        return "full";
+    }
+}
+
+EncodeOptions TerminalSink::outputOptions(const AsciiFrame& frame) const
+{
+    EncodeOptions options{frame.mode, frame.halfBlock};
+    options.palette256 = degrade_ >= OutputDegrade::Palette256;
+    options.coarse = degrade_ >= OutputDegrade::CoarseRuns;
+    return options;
+}
+
+bool TerminalSink::admitBytes(size_t bytes, Clock::time_point now)
+{
+    double budget = config_.maxWriteMBps * 1000.0 * 1000.0;
+    double rate = budget;
+    if (terminalRate_ > 0.0) {
+        rate = rate > 0.0 ? std::min(rate, terminalRate_) : terminalRate_;
+    }
+    if (rate <= 0.0) return true;
+
+    double need = static_cast<double>(bytes);
+    // The bucket always holds at least one frame, or a frame larger than the
+    // burst allowance could never be admitted.
+    double capacity = std::max(rate * kBucketSeconds, need);
+    if (lastRefill_ == Clock::time_point{}) {
+        tokens_ = capacity;
+        calmSince_ = now;
+    } else {
+        tokens_ = std::min(capacity, tokens_ + seconds_between(lastRefill_, now) * rate);
+    }
+    lastRefill_ = now;
+
+    // Skipped frames say nothing about whether the stage above would fit,
+    // so once the debt is repaid and a recovery period has passed, try it
+    // again; if it still overruns, the credit path below steps back down.
+    if (degrade_ == OutputDegrade::SkipFrames && tokens_ >= capacity
+        && seconds_between(lastChange_, now) > kRecoverSeconds) {
+        degrade_ = OutputDegrade::CoarseRuns;
+        calmSince_ = now;
+        lastChange_ = now;
+    }
+
+    if (need > tokens_) {
+        if (degrade_ == OutputDegrade::SkipFrames) {
+            return false;
+        }
+        calmSince_ = now;
+        // Send this frame on credit and degrade the following ones, giving
+        // each stage one bucket period to take effect before the next.
+        if (seconds_between(lastChange_, now) > kBucketSeconds) {
+            degrade_ = static_cast<OutputDegrade>(static_cast<int>(degrade_) + 1);
+            lastChange_ = now;
+        }
+    } else if (tokens_ - need < capacity * 0.5) {
+        calmSince_ = now;
+    } else if (degrade_ != OutputDegrade::None && seconds_between(calmSince_, now) > kRecoverSeconds) {
+        degrade_ = static_cast<OutputDegrade>(static_cast<int>(degrade_) - 1);
+        calmSince_ = now;
+        lastChange_ = now;
+        forceFull_ = true; // repaint at the restored precision
+    }
+    tokens_ -= need;
+    return true;
+}
+
+void TerminalSink::recordWrite(size_t bytes, double seconds, Clock::time_point now)
+{
+    if (seconds > kBlockedWriteSeconds && bytes > 0) {
+        double sample = static_cast<double>(bytes) / seconds;
+        terminalRate_ = terminalRate_ > 0.0 ? terminalRate_ * 0.8 + sample * 0.2 : sample;
+        lastBlocked_ = now;
+    } else if (terminalRate_ > 0.0 && seconds_between(lastBlocked_, now) > kRecoverSeconds) {
+        terminalRate_ = 0.0; // the terminal keeps up again
+    }
+}
+
+void TerminalSink::rememberFrame(const AsciiFrame& frame, const uint8_t* dirty)
+{
+    previous_.cols = frame.cols;
+    previous_.rows = frame.rows;
+    previous_.halfBlock = frame.halfBlock;
+    previous_.mode = frame.mode;
+    previous_.pts = frame.pts;
+    previous_.sequence = frame.sequence;
+    if (dirty) {
+        for (size_t i = 0; i < frame.cells.size(); ++i) {
+            if (dirty[i]) previous_.cells[i] = frame.cells[i];
+        }
+    } else {
+        previous_.cells.assign(frame.cells.begin(), frame.cells.end());
+    }
+    havePrevious_ = true;
+}
+
+void TerminalSink::appendRestore(const AsciiFrame& frame, const EncodeOptions& options)
+{
+    int rows = std::min(static_cast<int>(restore_.size()), frame.rows);
+    for (int row = 0; row < rows; ++row) {
+        int begin = restore_[row].first;
+        int end = std::min(restore_[row].second, frame.cols);
+        if (begin >= end) continue;
+        const AsciiCell* cells = frame.cells.data() + static_cast<size_t>(row) * frame.cols + begin;
+        char* tail = deltaBuffer_.reserveTail(kMaxCursorMoveBytes + max_encoded_cells(end - begin) + 4);
+        tail = encode_cursor_move(row, begin, tail);
+        tail = encode_cells(cells, end - begin, options, tail);
+        deltaBuffer_.commit(encode_literal("\x1b[0m", tail));
+    }
 }
 
 void TerminalSink::printStats(const std::string& statsLine)
 {
     if (!initialized_) return;
-    std::cout << "\x1b[s" << "\x1b[H" << statsLine << "\x1b[u";
-    std::cout.flush();
+    std::vector<int> widths;
+    overlay_.clear();
+    if (!statsLine.empty()) {
+        overlay_.assign("\x1b[s");
+        size_t width = presentedCols_ > 0 ? static_cast<size_t>(presentedCols_) : statsLine.size();
+        size_t begin = 0;
+        for (int row = 0; begin <= statsLine.size(); ++row) {
+            size_t end = std::min(statsLine.find('\n', begin), statsLine.size());
+            size_t length = std::min(end - begin, width);
+            char move[kMaxCursorMoveBytes + kEncodeSlackBytes];
+            overlay_.append(move, encode_cursor_move(row, 0, move));
+            overlay_.append(statsLine, begin, length);
+            widths.push_back(static_cast<int>(length));
+            begin = end + 1;
+        }
+        overlay_.append("\x1b[u");
+    }
+
+    // Cells the old overlay covered and the new one does not keep its text
+    // until the frame under them changes, so repaint them with the next frame.
+    if (restore_.size() < overlayWidths_.size()) restore_.resize(overlayWidths_.size(), {0, 0});
+    for (size_t row = 0; row < overlayWidths_.size(); ++row) {
+        int covered = row < widths.size() ? widths[row] : 0;
+        if (covered >= overlayWidths_[row]) continue;
+        std::pair<int, int>& span = restore_[row];
+        span.first = span.first < span.second ? std::min(span.first, covered) : covered;
+        span.second = std::max(span.second, overlayWidths_[row]);
+    }
+    overlayWidths_ = std::move(widths);
+}
+
+bool TerminalSink::windowSize(int& cols, int& rows) const
+{
+#ifdef _WIN32
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (!GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info)) return false;
+    cols = info.srWindow.Right - info.srWindow.Left + 1;
+    rows = info.srWindow.Bottom - info.srWindow.Top + 1;
+#else
+    winsize ws{};
+    if (::ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != 0) return false;
+    cols = ws.ws_col;
+    rows = ws.ws_row;
+#endif
+    return cols > 0 && rows > 0;
 }
 
 void TerminalSink::requestResize()
@@ -150,4 +488,30 @@ void TerminalSink::requestResize()
     resizeRequested_.store(true);
 }
 
+bool TerminalSink::takeResize()
+{
+    bool changed = resizeRequested_.exchange(false);
+#ifdef _WIN32
+    // The console has no resize signal; compare against the last size seen.
+    int cols = 0;
+    int rows = 0;
+    if (windowSize(cols, rows) && (cols != lastWindowCols_ || rows != lastWindowRows_)) {
+        changed = changed || lastWindowCols_ != 0;
+        lastWindowCols_ = cols;
+        lastWindowRows_ = rows;
+    }
+#else
+    if (gWindowChanged) {
+        gWindowChanged = 0;
+        changed = true;
+    }
+#endif
+    return changed;
+}
+
+void TerminalSink::invalidate()
+{
+    invalidated_.store(true);
+}
+
 } // namespace asciiplay
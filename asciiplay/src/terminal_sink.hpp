@@ -1,9 +1,15 @@
 #pragma once
 
+#include "ansi_encoder.hpp"
 #include "ascii_renderer.hpp"
+#include "metrics.hpp"
 
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <string>
+#include <utility>
+#include <vector>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -14,8 +20,22 @@
 namespace asciiplay {
 
 struct TerminalConfig {
-    double maxWriteMBps = 100.0;
+    double maxWriteMBps = 100.0; // <= 0 disables the write governor
     bool showStats = false;
+    // Rewrite only changed cells while at most this fraction of the screen
+    // changed; above it a full frame is sent. 0 disables delta output.
+    double diffThreshold = 0.0;
+    // Read key presses from stdin, which puts it in raw, non-blocking mode.
+    // Off when stdin carries the input stream.
+    bool keyboard = true;
+};
+
+// Stages the write governor steps through when output exceeds the budget.
+enum class OutputDegrade {
+    None,
+    Palette256,
+    CoarseRuns,
+    SkipFrames
 };
 
 class TerminalSink {
@@ -23,11 +43,31 @@ public:
     TerminalSink();
     ~TerminalSink();
 
-    bool initialize();
+    bool initialize(const TerminalConfig& cfg);
     void teardown();
+    // Encodes the cells itself when the frame carries no terminal string.
     void present(const AsciiFrame& frame);
+    // Replaces the overlay, one screen row per '\n'-separated line clipped to
+    // the frame width. It is redrawn on top of every frame until replaced; an
+    // empty line removes it.
     void printStats(const std::string& statsLine);
+    // Visible window in character cells; false when stdout is not a terminal.
+    bool windowSize(int& cols, int& rows) const;
     void requestResize();
+    // True once after a resize request or a window size change (SIGWINCH on
+    // POSIX, polled on Windows). Call from a single thread.
+    bool takeResize();
+    // Drops the delta cache and clears the screen before the next frame.
+    void invalidate();
+    OutputDegrade degradeLevel() const { return degrade_; }
+    const char* degradeLabel() const;
+    uint64_t skippedFrames() const { return skippedFrames_; }
+    // True once a write to stdout failed; later frames are not written.
+    bool writeFailed() const { return writeFailed_; }
+    // Escape encoding done here (delta and degraded frames) and the writes.
+    const LatencyHistogram& encodeTimes() const { return encodeTimes_; }
+    const LatencyHistogram& presentTimes() const { return presentTimes_; }
+    uint64_t bytesWritten() const { return bytesWritten_.load(std::memory_order_relaxed); }
 
 private:
     void enableVirtualTerminal();
@@ -36,8 +76,45 @@ private:
     void maximizeWindow();
     void enableRawMode();
     void disableRawMode();
+    void rememberFrame(const AsciiFrame& frame, const uint8_t* dirty);
+    void appendRestore(const AsciiFrame& frame, const EncodeOptions& options);
+    EncodeOptions outputOptions(const AsciiFrame& frame) const;
+    bool admitBytes(size_t bytes, std::chrono::steady_clock::time_point now);
+    void recordWrite(size_t bytes, double seconds, std::chrono::steady_clock::time_point now);
+
+    TerminalConfig config_;
+    AsciiFrame previous_;
+    bool havePrevious_ = false;
+    bool forceFull_ = false;
+    EncodeBuffer deltaBuffer_;
+    EncodeBuffer fullBuffer_;
+    std::string overlay_;
+    std::vector<int> overlayWidths_; // cells the overlay covers, per row
+    // Per row [begin, end) of cells a shrunken overlay no longer covers; the
+    // delta cache still thinks they show the frame, so they are repainted.
+    std::vector<std::pair<int, int>> restore_;
 
+    // Write governor: a token bucket filled at min(budget, measured terminal rate).
+    OutputDegrade degrade_ = OutputDegrade::None;
+    double tokens_ = 0.0;
+    double terminalRate_ = 0.0; // bytes/s seen on blocking writes, 0 = unknown
+    std::chrono::steady_clock::time_point lastRefill_{};
+    std::chrono::steady_clock::time_point lastBlocked_{};
+    std::chrono::steady_clock::time_point calmSince_{};
+    std::chrono::steady_clock::time_point lastChange_{};
+    uint64_t skippedFrames_ = 0;
+    bool writeFailed_ = false;
+    LatencyHistogram encodeTimes_;
+    LatencyHistogram presentTimes_;
+    std::atomic<uint64_t> bytesWritten_{0};
     std::atomic<bool> resizeRequested_{false};
+    std::atomic<bool> invalidated_{false};
+    int presentedCols_ = 0;
+    int presentedRows_ = 0;
+#ifdef _WIN32
+    int lastWindowCols_ = 0;
+    int lastWindowRows_ = 0;
+#endif
     bool initialized_ = false;
     bool rawEnabled_ = false;
 #ifdef _WIN32
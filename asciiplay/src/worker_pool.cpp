@@ -0,0 +1,78 @@
+#include "worker_pool.hpp"
+
+#include <algorithm>
+
+namespace asciiplay {
+
+WorkerPool::WorkerPool(size_t threads)
+{
+    size_t workers = std::max<size_t>(1, threads) - 1;
+    workers_.reserve(workers);
+    for (size_t i = 0; i < workers; ++i) {
+        workers_.emplace_back(&WorkerPool::workerLoop, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    startCv_.notify_all();
+    for (auto& worker : workers_) {
+        if (worker.joinable()) worker.join();
+    }
+}
+
+void WorkerPool::run(size_t count, const std::function<void(size_t)>& task)
+{
+    if (count == 0) return;
+    if (workers_.empty() || count == 1) {
+        for (size_t i = 0; i < count; ++i) task(i);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_ = &task;
+        count_ = count;
+        next_ = 0;
+        pending_ = count;
+        ++generation_;
+    }
+    startCv_.notify_all();
+    drain();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    doneCv_.wait(lock, [&] { return pending_ == 0; });
+    task_ = nullptr;
+}
+
+void WorkerPool::drain()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (task_ && next_ < count_) {
+        size_t index = next_++;
+        const auto* task = task_;
+        lock.unlock();
+        (*task)(index);
+        lock.lock();
+        if (--pending_ == 0) doneCv_.notify_all();
+    }
+}
+
+void WorkerPool::workerLoop()
+{
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            startCv_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+            if (stopping_) return;
+            seen = generation_;
+        }
+        drain();
+    }
+}
+
+} // namespace asciiplay
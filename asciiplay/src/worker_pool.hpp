@@ -0,0 +1,43 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace asciiplay {
+
+// Persistent fork/join pool. run() spreads task indices over the workers and
+// the calling thread, and returns once every index has been processed.
+class WorkerPool {
+public:
+    // `threads` counts the caller, so a pool of 1 spawns no workers.
+    explicit WorkerPool(size_t threads);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    size_t size() const { return workers_.size() + 1; }
+    void run(size_t count, const std::function<void(size_t)>& task);
+
+private:
+    void workerLoop();
+    void drain();
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable startCv_;
+    std::condition_variable doneCv_;
+    const std::function<void(size_t)>* task_ = nullptr;
+    size_t count_ = 0;
+    size_t next_ = 0;
+    size_t pending_ = 0;
+    uint64_t generation_ = 0;
+    bool stopping_ = false;
+};
+
+} // namespace asciiplay